@@ -25,15 +25,39 @@ You should have received a copy of the GNU General Public License
 along with alarm.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#ifdef __linux__
+#define _GNU_SOURCE                     /* for dladdr */
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#include <immintrin.h>
+#endif
+#ifdef __linux__
+#include <dlfcn.h>
+#include <errno.h>
+#include <malloc.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 #include <devLib.h>
 #include <errlog.h>
 #include <epicsMutex.h>
+#include <epicsExit.h>
 #include <epicsInterrupt.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <callback.h>
 
 #include "timer.h"
+#include "timer_conv.h"
 #include "almLib.h"
 
 #include <assert.h>
@@ -47,104 +71,832 @@ along with alarm.  If not, see <https://www.gnu.org/licenses/>.
 #define max(a,b) (a)>(b)?(a):(b)
 #endif
 
+/*
+ * Access to data shared between the interrupt handler and tasks without
+ * a common lock (see below). On SMP (Linux) the interrupt handler is a
+ * thread that may run on another core, so these use the compiler's
+ * atomic builtins with explicit memory order (same model as C11
+ * <stdatomic.h>, but usable with plain types and older compilers). On
+ * the uniprocessor RTOS targets the handler interrupts a task and runs
+ * to completion, so that volatile accesses are sufficient there.
+ */
+#if defined(__ATOMIC_ACQUIRE)
+#define alm_load_acquire(x)     __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define alm_load_relaxed(x)     __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define alm_store_release(x,v)  __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#define alm_store_relaxed(x,v)  __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+#define alm_fence_acquire()     __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define alm_fence_release()     __atomic_thread_fence(__ATOMIC_RELEASE)
+#define alm_fence_full()        __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define alm_decrement(x)        __atomic_sub_fetch(&(x), 1, __ATOMIC_RELEASE)
+#define alm_increment(x)        __atomic_add_fetch(&(x), 1, __ATOMIC_RELAXED)
+#define alm_cas_release(x,o,v)  __atomic_compare_exchange_n(&(x), &(o), (v),\
+                                    1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)
+#define alm_exchange_acquire(x,v) __atomic_exchange_n(&(x), (v), __ATOMIC_ACQUIRE)
+#else
+#define alm_load_acquire(x)     (*(volatile __typeof__(x) *)&(x))
+#define alm_load_relaxed(x)     (*(volatile __typeof__(x) *)&(x))
+#define alm_store_release(x,v)  ((*(volatile __typeof__(x) *)&(x)) = (v))
+#define alm_store_relaxed(x,v)  ((*(volatile __typeof__(x) *)&(x)) = (v))
+#define alm_fence_acquire()
+#define alm_fence_release()
+#define alm_fence_full()
+#define alm_decrement(x)        (--(*(volatile __typeof__(x) *)&(x)))
+#define alm_increment(x)        (++(*(volatile __typeof__(x) *)&(x)))
+#endif
+
+/* 64 bit time stamps: atomic only where this needs no library support */
+#if defined(__ATOMIC_ACQUIRE) && __GCC_ATOMIC_LLONG_LOCK_FREE == 2
+#define alm_load_stamp(x)       __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define alm_store_stamp(x,v)    __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+#else
+#define alm_load_stamp(x)       (*(volatile alm_stamp_t *)&(x))
+#define alm_store_stamp(x,v)    ((*(volatile alm_stamp_t *)&(x)) = (v))
+#endif
+
 /*
  * Main features of this implementation are:
  * - 64 bit timestamps avoid overflow problems
  * - alarm queue is always strictly sorted by time_due
- * - interrupt handler never modifies queue structure
- *   but merely resets alarm's active flag
+ * - interrupt handler never modifies queue structure while a task
+ *   holds the queue, but merely resets alarm's active flag
  * - thus, queue operations can be interrupted at any time
- *   (pointer assignment is assumed to be atomic)
  *   => no int lock necessary during queue operations
- * - only alm_setup_alarm and alm_get_stamp lock interrupts
+ * - when no task holds the queue, the handler re-files periodic alarms
+ *   itself at the end of an activation (alm_period_flush); tasks
+ *   announce that they hold it with interrupts locked (alm_queue_enter)
+ * - this requires that a new or moved alarm is completely set up before
+ *   it is linked into the queue: links are published with release
+ *   stores and read by the interrupt handler with acquire loads
+ * - an alarm the handler is currently looking at may be re-filed (its
+ *   time due and next link change). To detect this, tasks increment
+ *   alm_queue_gen before changing an alarm's time due or links, and the
+ *   handler re-scans the queue if it has changed during a pass (like a
+ *   sequence lock). Re-scanning is harmless since fired alarms are
+ *   inactive.
+ * - before freeing an alarm that was in the queue, tasks wait until a
+ *   running activation of the handler has finished (alm_release); the
+ *   handler makes alm_epoch odd while it runs, so that the worker can
+ *   wait for this without locking (alm_reclaim)
+ * - besides alm_queue_enter, only alm_setup_alarm and alm_get_stamp
+ *   lock interrupts
+ * - work the interrupt handler must not do itself (e.g. re-filing a
+ *   postponed alarm) is handed over to the worker thread via the
+ *   work list; pushing and popping entries locks interrupts
+ *
+ * Clock domains: the queue runs on the timer's monotonic clock. Alarms
+ * started with alm_start_at_epics (wall clock) are queued with the
+ * corresponding monotonic time due and are additionally kept in the
+ * wall list. The worker thread regularly compares wall and monotonic
+ * clock and re-files all wall clock alarms if the difference changes,
+ * i.e. if the wall clock has been set or stepped.
+ *
+ * Internal time base: normally all time stamps (time_due, the timer
+ * setup, statistics) are kept in microseconds. If ALM_TICK_NATIVE is
+ * defined (see Makefile), the backend provides its native counter
+ * through timer_get_ticks and timer_setup_ticks (see timer.h) and all
+ * internal times are kept in ticks. Conversion to and from microseconds
+ * then happens only in the public interface (alm_start, alm_get_stamp,
+ * configuration and statistics routines).
  */
 
+#ifdef ALM_TICK_NATIVE
+static unsigned long alm_ticks_per_usec;
+static timer_conv_t alm_tick_conv;
+
+#define alm_now()               timer_get_ticks()
+#define usec_to_ticks(us)       ((alm_stamp_t)(us) * alm_ticks_per_usec)
+#define ticks_to_usec(t)        timer_conv_div(&alm_tick_conv, (t))
+#define ticks_to_nsec(t)        ((t) * 1000 / alm_ticks_per_usec)
+#define alm_timer_setup(t)      timer_setup_ticks(t)
+#define alm_timer_max_delay()   timer_get_max_ticks()
+#else
+#define alm_now()               alm_get_stamp()
+#define usec_to_ticks(us)       ((alm_stamp_t)(us))
+#define ticks_to_usec(t)        (t)
+#define ticks_to_nsec(t)        ((t) * 1000)
+#define alm_timer_setup(t)      timer_setup(t)
+#define alm_timer_max_delay()   timer_get_max_delay()
+#endif
+
+/* initialize timer and internal time base, may be called repeatedly */
+static void alm_time_init(void)
+{
+    timer_init();
+#ifdef ALM_TICK_NATIVE
+    if (!alm_ticks_per_usec) {
+        timer_conv_init(&alm_tick_conv, timer_get_ticks_per_usec());
+        alm_ticks_per_usec = timer_get_ticks_per_usec();
+    }
+#endif
+}
+
+/*
+ * Beyond the expiry index, the interrupt handler compares time_due and
+ * follows next for every alarm it passes, but touches callback and arg
+ * only for those it actually fires. Keep the former together at the
+ * start of the struct (the first 24 bytes), so that passing an alarm
+ * usually touches a single cache line, although the struct as a whole
+ * spans several.
+ */
 struct alm_def {
-    void            *arg;
-    alm_callback    *callback;
     alm_stamp_t     time_due;
+    struct alm_def  *next;
     int             active;
     int             enqueued;
-    struct alm_def  *next;
+    int             postponed;      /* time_postponed is valid */
+    int             priority;       /* alm_priority_t */
+    alm_callback    *callback;
+    void            *arg;
+    unsigned        flags;
+    alm_stamp_t     time_postponed; /* see alm_postpone */
+    struct alm_def  *work_next;     /* link in work list */
+    int             work_pending;   /* in work list */
+    int             shed;           /* callback to be run by worker */
+    alm_delay_t     period;         /* see alm_start_periodic */
+    alm_stamp_t     time_wall;      /* wall clock due (us), 0 if none */
+    struct alm_def  *wall_next;     /* link in wall list */
+    int             wall_listed;    /* in wall list */
+    alm_delay_t     miss_threshold; /* see alm_set_miss_threshold */
+    unsigned long   misses;
+    struct alm_group_def *group;    /* see alm_create_in */
+    unsigned long   group_gen;      /* group->gen when started */
+    struct alm_def  *group_next;    /* links in member list */
+    struct alm_def  *group_prev;
+    epicsThreadId   running;        /* thread in callback, see alm_cancel_sync */
+    struct alm_def  *retire_next;   /* link in retire list */
+    int             retired;        /* destroyed, see alm_reclaim */
+};
+
+/*
+ * Alarm groups: alm_group_cancel only increments the generation. A
+ * member whose group_gen differs is stale, i.e. cancelled: the handler
+ * does not fire it, and it is removed from the queue like an inactive
+ * alarm. The member list (changed with alm_lock held) is only needed
+ * for alm_group_destroy. Each member holds a reference to the group,
+ * which is dropped when alm_reclaim frees it; the group's own reference
+ * is dropped by alm_group_destroy. The last one frees the group.
+ */
+struct alm_group_def {
+    unsigned long   gen;
+    struct alm_def  *members;
+    unsigned long   refs;
+};
+
+#define alm_stale(alm) ((alm)->group\
+    && alm_load_relaxed((alm)->group_gen)\
+        != alm_load_acquire((alm)->group->gen))
+
+/* flags */
+#define ALM_STATIC  0x1                 /* storage owned by caller */
+#define ALM_CALLBACK 0x2                /* see alm_create_callback */
+#define ALM_STATS   0x4                 /* see alm_create_ex */
+#define ALM_BATCH   0x8                 /* see alm_create_batch */
+
+/*
+ * Statistics of an alarm created with ALM_CREATE_STATS, allocated behind
+ * the alarm. Fire counts and times are written by the interrupt handler
+ * (or the worker for shed alarms) only, in internal time units.
+ */
+struct alm_stat_def {
+    unsigned long   starts;
+    unsigned long   fires;
+    unsigned long   cancels;
+    alm_delay_t     latency_last;
+    alm_delay_t     latency_max;
+    alm_delay_t     duration_last;
 };
 
+#define alm_stat_of(alm) ((struct alm_stat_def *)((alm) + 1))
+
+/* compile time check: alm_storage_t must be large enough */
+typedef char alm_storage_check[
+    sizeof(struct alm_def) <= sizeof(alm_storage_t) ? 1 : -1];
+
 static alm_init_state_t init_state = ALM_NO_INIT;
                                         /* this module's initialization state */
 static epicsMutexId alm_lock;           /* global mutex */
 static alm_t first_alm;                 /* head of alm_t object queue */
+static unsigned long alm_queue_gen;     /* queue modification count */
+static unsigned alm_queue_busy;         /* tasks in alm_queue_enter */
+
+/*
+ * Expiry index: time due and address of the first ALM_INDEX_SIZE
+ * alarms in the queue, in two contiguous arrays. The interrupt handler
+ * counts the due entries in one (vectorised) pass over the times and
+ * then visits just these alarms, whose addresses it knows up front,
+ * instead of following next links from alarm to alarm. Tasks use it to
+ * find an alarm's position in the queue without walking its head.
+ *
+ * The index is changed together with the queue, with alm_lock held, in
+ * a copy, which is then published with a release store. The handler
+ * announces the copy it uses in alm_index_held and re-checks that it is
+ * still published (with a full fence on both sides, like alm_fire);
+ * tasks make the next copy in a buffer that is neither published nor
+ * held. So the handler always sees a complete copy that does not change
+ * under its feet. Like the links it may be outdated by the time the
+ * handler uses it (see alm_queue_gen), so the handler still checks each
+ * alarm's time due before firing it, and continues beyond the index by
+ * following links.
+ */
+#define ALM_INDEX_SIZE 32               /* multiple of 4 */
+
+struct alm_index_def {
+    alm_stamp_t     due[ALM_INDEX_SIZE];
+    alm_t           alm[ALM_INDEX_SIZE];
+    unsigned        count;              /* entries in use */
+};
+
+static struct alm_index_def alm_index_buf[3];
+static struct alm_index_def *alm_index = &alm_index_buf[0]; /* published */
+static struct alm_index_def *alm_index_held; /* in use by the handler */
+static int alm_index_off;               /* handler ignores index (tests) */
+static alm_t alm_work_list;             /* alarms handed over to worker */
+static alm_t alm_period_list;           /* see alm_next_period */
+static epicsEventId alm_work_event;     /* wakes up worker thread */
+static epicsThreadId alm_worker_id;     /* worker thread, once created */
+static unsigned alm_worker_priority = epicsThreadPriorityScanHigh - 1;
+static alm_t alm_wall_list;             /* alarms with wall clock due */
+static alm_t alm_retire_list;           /* destroyed alarms, see alm_reclaim */
+static unsigned long alm_epoch;         /* odd while the handler runs */
+
+static struct {                         /* dispatcher statistics */
+    unsigned long   activations;        /* interrupt handler runs */
+    unsigned long   fired;              /* callbacks called */
+    alm_stamp_t     busy;               /* total time spent in handler */
+    alm_stamp_t     max_busy;           /* longest single activation */
+    unsigned long   spins;              /* interrupts saved by spinning */
+    alm_stamp_t     spin_time;          /* total time spent spinning */
+    unsigned long   rescans;            /* queue changed during a pass */
+    unsigned long   overruns;           /* periods skipped */
+    unsigned long   clock_steps;        /* wall clock changes detected */
+    unsigned long   deferred;           /* alarms deferred (budget) */
+    unsigned long   shed;               /* alarms shed to worker (budget) */
+    unsigned long   cb_queued;          /* EPICS callbacks collected */
+    unsigned long   cb_requests;        /* batches passed to callbackRequest */
+    unsigned long   batch_queued;       /* args collected for batches */
+    unsigned long   batch_calls;        /* batch callbacks called */
+    unsigned long   timer_arms;         /* low-level timer set up */
+    unsigned long   arms_avoided;       /* set up elided or merged */
+    unsigned long   misses;             /* deadline misses */
+    unsigned long   miss_dropped;       /* miss records lost */
+} alm_stats;
+
+static alm_delay_t alm_spin_threshold;  /* see alm_set_spin_threshold */
+static int alm_prio_used;               /* some alarm has high priority */
+static unsigned long alm_budget_count;  /* see alm_set_budget */
+static alm_delay_t alm_budget_time;
+static int alm_rt;                      /* see alm_init_ex */
+static alm_delay_t alm_arm_tolerance;   /* see alm_set_arm_tolerance */
+static int alm_in_handler;              /* handler is dispatching */
+static epicsThreadId alm_handler_thread; /* thread running the handler */
+
+/*
+ * Latency compensation: the timer is set up alm_latency_offset
+ * (internal time units) early and the interrupt handler spins for the
+ * remaining time. The offset is fixed (initially zero, i.e. off) unless
+ * tracking is enabled with alm_set_latency_offset: then it follows the
+ * measured difference between the programmed expiration time alm_armed
+ * and the time the handler actually runs. The latency is measured in
+ * either case (see alm_dump_stats).
+ */
+#define NOT_ARMED 0xffffffffffffffffull
+static alm_stamp_t alm_armed = NOT_ARMED;
+static alm_delay_t alm_latency_offset;  /* currently applied offset */
+static int alm_latency_fixed = 1;       /* offset not tracked */
+static struct {
+    unsigned long   samples;            /* number of measurements */
+    alm_delay_t     avg16;              /* average latency * 16 */
+    alm_delay_t     last;               /* last measured latency */
+    alm_delay_t     max;                /* maximum measured latency */
+} alm_latency;
+
+#define LATENCY_WEIGHT 16               /* 1/weight of each new sample */
+#define LATENCY_CLIP_FLOOR 20           /* minimum clip bound (microseconds) */
+#define CALIBRATION_SAMPLES 16          /* see ALM_INIT_CALIBRATE */
+#define CALIBRATION_DELAY 1000          /* delay used for measurements */
 
 static void alm_insert(alm_t what);
+static void alm_deactivate(alm_t alm);
+static void alm_insert_from(alm_t prev, alm_t what);
 static void alm_purge(void);
+static void alm_queue_modify(void);
+static void alm_queue_enter(void);
+static void alm_queue_leave(void);
+static void alm_work_push(alm_t what);
+static void alm_next_period(alm_t what, alm_stamp_t now);
+static alm_stamp_t alm_period_flush(alm_stamp_t due);
+static void alm_cb_flush(void);
+static void alm_batch_flush(void);
+static void alm_batch_leave(alm_t alm);
 static void alm_remove(alm_t what);
+static void alm_reclaim(void);
+static int alm_retire_push(alm_t alm);
 static void alm_setup_alarm(alm_stamp_t time_due, int from_int_handler);
 
 /* Low level stuff */
 
+/* in microseconds; use usec_to_ticks for internal time units */
 #define MAX_WAIT 0x80000000ull
 #define MIN_WAIT 0x2ull
+#define MAX_SPIN_THRESHOLD 1000         /* see alm_set_spin_threshold */
+#define MAX_ARM_TOLERANCE 1000          /* see alm_set_arm_tolerance */
+#define MAX_BUDGET_COUNT 100000         /* see alm_set_budget */
+#define MAX_BUDGET_TIME 1000000
+
+#define MAX_RESCANS 3                   /* per activation of the handler */
+
+/* real-time hardening, see alm_init_ex */
+#define RT_STACK_PREFAULT   (32*1024)
+#define RT_HEAP_RESERVE     (1024*1024)
+
+/* touch the stack of the calling thread down to RT_STACK_PREFAULT bytes */
+static void alm_prefault_stack(void)
+{
+    volatile char buf[RT_STACK_PREFAULT];
+    size_t n;
+
+    for (n = 0; n < sizeof(buf); n += 256)
+        buf[n] = 0;
+}
+
+/*
+ * Account for one latency measurement. The first LATENCY_WEIGHT
+ * samples are averaged, later ones enter an exponentially weighted
+ * average. Samples are limited to twice the current average so that
+ * single outliers (e.g. page faults or scheduling delays on Linux) do
+ * not lead to excessive spinning, but not below LATENCY_CLIP_FLOOR:
+ * otherwise an average that starts at (or decays to) almost zero could
+ * never grow again when the latency increases.
+ */
+static void alm_latency_sample(alm_stamp_t now)
+{
+    alm_delay_t sample, avg, clip;
+
+    sample = now > alm_armed ? now - alm_armed : 0;
+    alm_latency.last = sample;
+    if (sample > alm_latency.max)
+        alm_latency.max = sample;
+    if (alm_latency.samples < LATENCY_WEIGHT) {
+        alm_latency.avg16 = (alm_latency.avg16 * alm_latency.samples
+            + sample * LATENCY_WEIGHT) / (alm_latency.samples + 1);
+        alm_latency.samples++;
+    } else {
+        alm_latency.samples++;
+        avg = alm_latency.avg16 / LATENCY_WEIGHT;
+        clip = usec_to_ticks(LATENCY_CLIP_FLOOR);
+        if (clip < 2 * avg)
+            clip = 2 * avg;
+        if (sample > clip)
+            sample = clip;
+        alm_latency.avg16 = alm_latency.avg16 - avg + sample;
+    }
+    if (!alm_latency_fixed)
+        alm_latency_offset = alm_latency.avg16 / LATENCY_WEIGHT;
+}
+
+/*
+ * Deadline misses are recorded in a ring buffer (under the interrupt
+ * lock, by the handler or by the worker for shed alarms) and passed to
+ * the miss hook by the worker thread.
+ */
+#define MISS_RING_SIZE 64               /* power of 2 */
+
+static struct {
+    alm_miss_t      rec[MISS_RING_SIZE];
+    unsigned        head;               /* written by handler */
+    unsigned        tail;               /* written by worker */
+    alm_miss_hook   *hook;
+    void            *user;
+} alm_miss;
+
+/* check lateness of an alarm whose callback is about to be called */
+static void alm_miss_check(alm_t alm)
+{
+    alm_stamp_t due = alm_load_stamp(alm->time_due);
+    alm_stamp_t now = alm_now();
+    alm_miss_t *rec;
+
+    if (now < due || now - due <= alm_load_relaxed(alm->miss_threshold)) {
+        return;
+    }
+    alm_store_relaxed(alm->misses, alm->misses + 1);
+    alm_stats.misses++;
+    if (alm_miss.head - alm_load_acquire(alm_miss.tail) >= MISS_RING_SIZE) {
+        alm_stats.miss_dropped++;
+        return;
+    }
+    rec = &alm_miss.rec[alm_miss.head % MISS_RING_SIZE];
+    rec->alm = alm;
+    rec->callback = alm->callback;
+    rec->arg = alm->arg;
+    rec->due = ticks_to_usec(due);
+    rec->late = ticks_to_usec(now - due);
+    rec->misses = alm->misses;
+    alm_store_release(alm_miss.head, alm_miss.head + 1);
+}
+
+/* pass miss records to the hook, called by the worker with alm_lock */
+static void alm_miss_run(void)
+{
+    alm_miss_t rec;
+
+    while (alm_miss.tail != alm_load_acquire(alm_miss.head)) {
+        rec = alm_miss.rec[alm_miss.tail % MISS_RING_SIZE];
+        alm_store_release(alm_miss.tail, alm_miss.tail + 1);
+        if (alm_miss.hook) {
+            alm_miss.hook(&rec, alm_miss.user);
+        }
+    }
+}
+
+/* invalidate pending records of an alarm, with alm_lock and interrupt lock */
+static void alm_miss_forget(alm_t alm)
+{
+    unsigned n;
+
+    for (n = alm_miss.tail; n != alm_miss.head; n++) {
+        if (alm_miss.rec[n % MISS_RING_SIZE].alm == alm) {
+            alm_miss.rec[n % MISS_RING_SIZE].alm = 0;
+        }
+    }
+}
+
+/* call the callback of an alarm with ALM_STATS, measuring times */
+static void alm_call_stats(alm_t alm)
+{
+    struct alm_stat_def *st = alm_stat_of(alm);
+    alm_stamp_t due = alm_load_stamp(alm->time_due);
+    alm_stamp_t start = alm_now();
+    alm_delay_t latency = start > due ? start - due : 0;
+
+    alm->callback(alm->arg);
+    alm_store_relaxed(st->duration_last, alm_now() - start);
+    alm_store_relaxed(st->latency_last, latency);
+    if (latency > st->latency_max)
+        alm_store_relaxed(st->latency_max, latency);
+    alm_store_relaxed(st->fires, st->fires + 1);
+}
+
+/*
+ * Fire one due alarm, called by the interrupt handler.
+ *
+ * Handshake with alm_cancel_sync: the handler announces the call in
+ * alm->running before it (again) checks active, the canceller clears
+ * active before it checks running. With a full fence on both sides, at
+ * least one of them sees the other's write: either the handler does not
+ * call the callback, or the canceller waits for it to return.
+ */
+static void alm_fire(alm_t alm, alm_stamp_t now)
+{
+    alm_store_relaxed(alm->running, alm_load_relaxed(alm_handler_thread));
+    alm_fence_full();
+    if (!alm_load_relaxed(alm->active)) {
+        alm_store_release(alm->running, 0);
+        return;                         /* cancelled meanwhile */
+    }
+    /* reset first, the callback may restart the alarm */
+    alm_store_release(alm->active, 0);
+    if (alm_stale(alm)) {
+        alm_store_release(alm->running, 0);
+        return;                         /* group has been cancelled */
+    }
+    if (alm_load_relaxed(alm->postponed)) {
+        /* deadline has been moved: let worker re-file it */
+        alm_work_push(alm);
+    } else {
+        if (alm_load_relaxed(alm->miss_threshold)) {
+            alm_miss_check(alm);
+        }
+        if (alm->flags & ALM_STATS) {
+            alm_call_stats(alm);
+        } else {
+            alm->callback(alm->arg);
+        }
+        alm_stats.fired++;
+        if (alm_load_relaxed(alm->period)
+                && !alm_load_relaxed(alm->active)
+                && !alm_load_relaxed(alm->postponed)) {
+            alm_next_period(alm, now);  /* unless restarted, see above */
+        }
+        if (alm->flags & ALM_BATCH) {
+            return;                     /* running cleared by alm_batch_call */
+        }
+    }
+    alm_store_release(alm->running, 0);
+}
+
+/* true if the budget of the current activation is used up */
+static int alm_over_budget(unsigned long fired, alm_stamp_t start)
+{
+    return (alm_budget_count && fired >= alm_budget_count)
+        || (alm_budget_time && alm_now() - start >= alm_budget_time);
+}
+
+/*
+ * Budget exhausted: hand due low priority alarms from <alm> on to the
+ * worker thread. Normal priority alarms stay queued for the next
+ * activation; the first of them is returned (NULL if none).
+ */
+static alm_t alm_defer(alm_t alm, alm_stamp_t now)
+{
+    alm_t first = 0;
+
+    for (; alm && alm_load_stamp(alm->time_due) <= now;
+            alm = alm_load_acquire(alm->next)) {
+        if (!alm_load_acquire(alm->active)) {
+            continue;
+        }
+        if (alm_stale(alm)) {
+            alm_store_release(alm->active, 0);
+            continue;
+        }
+        if (alm->priority == ALM_PRIO_LOW
+                && !alm_load_relaxed(alm->postponed)
+                && !(alm->flags & ALM_BATCH)) {
+            alm_store_release(alm->active, 0);
+            alm_store_relaxed(alm->shed, 1);
+            alm_work_push(alm);
+            alm_stats.shed++;
+        } else {
+            if (!first)
+                first = alm;
+            alm_stats.deferred++;
+        }
+    }
+    return first;
+}
+
+/*
+ * Number of leading index entries due at <stamp>, i.e. not later. The
+ * times are sorted, so the first entry that is later ends the scan. The
+ * vector versions compare four (AVX2) or two (SSE4.2) times at once;
+ * time stamps are below 2^63, so a signed comparison is correct. On
+ * other targets (e.g. AltiVec has no 64 bit compare) a plain loop is
+ * used. Lanes beyond count may hold anything: the result is clipped.
+ */
+static unsigned alm_index_count(const struct alm_index_def *idx,
+    alm_stamp_t stamp)
+{
+    unsigned n = idx->count, i;
+#if defined(__AVX2__)
+    __m256i t = _mm256_set1_epi64x((long long)stamp);
+    int later;
+
+    for (i = 0; i < n; i += 4) {
+        later = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(
+            _mm256_loadu_si256((const __m256i *)&idx->due[i]), t)));
+        if (later) {
+            i += __builtin_ctz(later);
+            break;
+        }
+    }
+#elif defined(__SSE4_2__)
+    __m128i t = _mm_set1_epi64x((long long)stamp);
+    int later;
+
+    for (i = 0; i < n; i += 2) {
+        later = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(
+            _mm_loadu_si128((const __m128i *)&idx->due[i]), t)));
+        if (later) {
+            i += __builtin_ctz(later);
+            break;
+        }
+    }
+#else
+    for (i = 0; i < n && idx->due[i] <= stamp; i++)
+        ;
+#endif
+    return i < n ? i : n;
+}
+
+/*
+ * Position of the interrupt handler in the queue. The first n alarms
+ * are taken from the expiry index, of which the first ndue are due;
+ * beyond, the handler follows links and compares times as usual.
+ */
+struct alm_pos {
+    const struct alm_index_def *idx;
+    unsigned        i;                  /* position of alm in queue */
+    unsigned        n;                  /* alarms in index */
+    unsigned        ndue;               /* alarms in index due at now */
+    alm_t           alm;                /* NULL at end of queue */
+};
+
+/* count due index entries at <now>, start fetching these alarms */
+static void alm_pos_update(struct alm_pos *pos, alm_stamp_t now)
+{
+    unsigned i;
+
+    if (!pos->idx)
+        return;
+    pos->ndue = alm_index_count(pos->idx, now);
+#if defined(__GNUC__)
+    for (i = pos->i; i < pos->ndue; i++) {
+        __builtin_prefetch(pos->idx->alm[i]);
+    }
+#endif
+}
+
+/* start at the head of the queue, with index <idx> (may be NULL) */
+static void alm_pos_first(struct alm_pos *pos,
+    const struct alm_index_def *idx, alm_stamp_t now)
+{
+    pos->idx = idx;
+    pos->i = 0;
+    pos->n = pos->idx ? pos->idx->count : 0;
+    pos->ndue = 0;
+    pos->alm = pos->n ? pos->idx->alm[0] : alm_load_acquire(first_alm);
+    alm_pos_update(pos, now);
+}
+
+static void alm_pos_next(struct alm_pos *pos)
+{
+    if (++pos->i < pos->n) {
+        pos->alm = pos->idx->alm[pos->i];
+    } else {
+        pos->alm = alm_load_acquire(pos->alm->next);
+    }
+}
+
+/* true if the alarm at <pos> is due at <now> (index: as far as known) */
+static int alm_pos_due(const struct alm_pos *pos, alm_stamp_t now)
+{
+    if (pos->i < pos->n)
+        return pos->i < pos->ndue;
+    return pos->alm && alm_load_stamp(pos->alm->time_due) <= now;
+}
 
 /*
  * Interrupt handler is called at least every MAX_WAIT microseconds.
  * This ensures that alm_get_stamp is called often enough to check for 
  * timer counter overflow. See alm_get_stamp() below.
  *
- * Note: the interrupt handler does not modify queue structure
- * or its global anchor first_alm. It merely sets active flags to false.
+ * If the next active alarm is due within alm_spin_threshold microseconds,
+ * the handler busy-waits for it instead of returning and taking another
+ * interrupt. Since the timer is set up alm_latency_offset microseconds
+ * early, this also applies to alarms due within that offset.
+ *
+ * Due alarms of priority ALM_PRIO_HIGH are fired first. The others are
+ * subject to the budget (see alm_set_budget): once it is used up, the
+ * remaining due alarms are deferred to the next activation (normal
+ * priority) or shed to the worker thread (low priority).
+ *
+ * Note: while dispatching, the interrupt handler does not modify queue
+ * structure or its global anchor first_alm. It merely sets active flags
+ * to false, and hands postponed alarms over to the worker thread. Only
+ * at the end it re-files periodic alarms, if no task holds the queue
+ * (see alm_period_flush).
  */
 static void alm_int_handler()
 {
-    alm_t alm = first_alm;
-    alm_stamp_t now;
+    alm_t alm, deferred;
+    struct alm_index_def *idx;
+    struct alm_pos pos, high;
+    alm_stamp_t now, start, busy, due;
+    unsigned long fired = 0, gen;
+    int budget = alm_budget_count || alm_budget_time;
+    int rescans = 0;
 
     timer_int_ack();
-    now = alm_get_stamp();
-    while (alm && alm->time_due <= now) {
-        if (alm->active) {
-            alm->callback(alm->arg);
-            alm->active = 0;
+    start = now = alm_now();
+    alm_stats.activations++;
+    alm_store_relaxed(alm_epoch, alm_epoch + 1);
+    alm_fence_full();                   /* see alm_reclaim */
+#ifdef __linux__
+    alm_store_relaxed(alm_handler_thread, epicsThreadGetIdSelf());
+#endif
+    alm_latency_sample(now);
+    alm_armed = NOT_ARMED;              /* timer has expired, maybe early */
+    alm_in_handler = 1;
+rescan:
+    gen = alm_load_acquire(alm_queue_gen);
+    idx = alm_index_off ? 0 : alm_load_acquire(alm_index);
+    alm_store_release(alm_index_held, idx);
+    alm_fence_full();                   /* see alm_index_edit */
+    if (alm_load_acquire(alm_index) != idx) {
+        idx = 0;                        /* replaced meanwhile: walk links */
+    }
+    alm_pos_first(&pos, idx, now);
+    deferred = 0;
+    for (;;) {
+        if (alm_prio_used) {
+            for (high = pos; alm_pos_due(&high, now); alm_pos_next(&high)) {
+                alm = high.alm;
+                if (alm_load_acquire(alm->active)
+                        && alm_load_stamp(alm->time_due) <= now
+                        && alm->priority == ALM_PRIO_HIGH)
+                    alm_fire(alm, now);
+            }
+        }
+        while (alm_pos_due(&pos, now)) {
+            alm = pos.alm;
+            if (alm_load_acquire(alm->active)
+                    && alm_load_stamp(alm->time_due) <= now) {
+                if (budget && alm_over_budget(fired, start)) {
+                    deferred = alm_defer(alm, now);
+                    break;
+                }
+                alm_fire(alm, now);
+                fired++;
+            }
+            alm_pos_next(&pos);
+        }
+        if (deferred) {
+            alm = deferred;             /* next activation as soon as possible */
+            break;
+        }
+        while (pos.alm && !alm_load_acquire(pos.alm->active)) {
+            alm_pos_next(&pos);
         }
-        alm = alm->next;
+        alm = pos.alm;
+        if (!alm ||
+            alm_load_stamp(alm->time_due) - now
+                > alm_spin_threshold + alm_latency_offset) {
+            break;
+        }
+        busy = now;
+        do {
+            now = alm_now();
+        } while (now < alm_load_stamp(alm->time_due));
+        alm_stats.spins++;
+        alm_stats.spin_time += now - busy;
+        alm_pos_update(&pos, now);
+    }
+    alm_batch_flush();                  /* may restart alarms */
+    due = alm ? alm_load_stamp(alm->time_due) : now + usec_to_ticks(MAX_WAIT);
+    alm_fence_acquire();
+    if (alm_load_relaxed(alm_queue_gen) != gen) {
+        /* queue changed under our feet: we may have missed an alarm */
+        alm_stats.rescans++;
+        if (rescans++ < MAX_RESCANS) {
+            goto rescan;
+        }
+        due = now;                      /* give up, try again soon */
     }
-    while (alm && !alm->active) {
-        alm = alm->next;
+    if (alm_period_list) {
+        due = alm_period_flush(due);    /* after the check: not a change */
     }
     /* ensure that we have always at least one active timer running
        that expires in no more than MAX_WAIT microseconds */
-    if (alm) {
-        assert(alm->active);
-        alm_setup_alarm(alm->time_due, 1);
-    } else {
-        alm_setup_alarm(now + MAX_WAIT, 1);
+    alm_setup_alarm(due, 1);
+    alm_store_release(alm_index_held, 0);
+    alm_in_handler = 0;
+    if (alm_work_list || alm_miss.head != alm_load_relaxed(alm_miss.tail)) {
+        epicsEventSignal(alm_work_event);
     }
+    alm_cb_flush();
+    busy = alm_now() - start;
+    alm_stats.busy += busy;
+    if (busy > alm_stats.max_busy)
+        alm_stats.max_busy = busy;
+    alm_store_release(alm_epoch, alm_epoch + 1);
 }
 
 /*
  * Make sure an interrupt will be scheduled at time_due.
  *
  * We remember the time stamp when the next interrupt is expected
- * in the static variable next_due. The low-level timer is setup with
- * delay = time_due - time_now, but only if called from interrupt, or else
- * if time_due <= next_due.
+ * in the static variable alm_armed (NOT_ARMED once it has expired).
+ * The low-level timer is setup with
+ * delay = time_due - alm_latency_offset - time_now, but only if called
+ * from interrupt, or else if that is earlier than alm_armed.
  * We also limit the delay to be setup by MAX_WAIT above and by MIN_WAIT below.
+ * For task requests, setting up the timer is skipped if it is already
+ * armed no more than alm_arm_tolerance later than required. The handler
+ * always re-arms: a one-shot timer may have fired early (e.g. due to a
+ * truncated tick rate), so the previous setting cannot be relied upon.
+ * Requests made by callbacks
+ * while the handler is dispatching are merged into the one the handler
+ * makes before it returns (it rescans the queue if it was modified).
  */
 static void alm_setup_alarm(alm_stamp_t time_due, int from_int_handler)
 {
-    alm_stamp_t time_now, delay;
-    static alm_stamp_t next_due = 0xffffffffffffffffull;
+    alm_stamp_t time_now, delay, max_delay;
     int lock_stat = 0;
-    unsigned long max_delay;
 
     if (!from_int_handler) lock_stat = epicsInterruptLock();
-    if (from_int_handler || time_due <= next_due) {
-        time_now = alm_get_stamp();
+    if (time_due > alm_latency_offset)
+        time_due -= alm_latency_offset;
+    if (alm_in_handler && !from_int_handler) {
+        alm_stats.arms_avoided++;
+    } else if (from_int_handler || time_due <= alm_armed) {
+        time_now = alm_now();
         if (time_due < time_now)
             time_due = time_now;
         delay = time_due - time_now;
-        max_delay = min(timer_get_max_delay(), MAX_WAIT);
+        max_delay = min(alm_timer_max_delay(), usec_to_ticks(MAX_WAIT));
         if (delay > max_delay) delay = max_delay;
-        if (delay < MIN_WAIT) delay = MIN_WAIT;
-        next_due = time_now + delay;
-        timer_setup(delay);
+        if (delay < usec_to_ticks(MIN_WAIT)) delay = usec_to_ticks(MIN_WAIT);
+        if (!from_int_handler && alm_armed != NOT_ARMED
+                && alm_armed >= time_now + delay
+                && alm_armed - (time_now + delay) <= alm_arm_tolerance) {
+            alm_stats.arms_avoided++;
+        } else {
+            alm_armed = time_now + delay;
+            alm_timer_setup(delay);
+            alm_stats.timer_arms++;
+        }
     }
     if (!from_int_handler) epicsInterruptUnlock(lock_stat);
 }
@@ -155,10 +907,15 @@ static void alm_setup_alarm(alm_stamp_t time_due, int from_int_handler)
  * Note: Must be called at least every ULONG_MAX microseconds, in order
  * to recognize low-level timer count overflow and properly calculate
  * the high word of the returned timestamp. See interrupt handler and
- * alm_init.
+ * alm_init. This does not apply to ALM_TICK_NATIVE, where the backend
+ * provides a full 64 bit counter.
  */
 alm_stamp_t alm_get_stamp(void)
 {
+#ifdef ALM_TICK_NATIVE
+    alm_time_init();
+    return ticks_to_usec(timer_get_ticks());
+#else
     static alm_stamp_t high_word = 0;
     static unsigned long last_time = 0;
     unsigned long now;
@@ -175,339 +932,3349 @@ alm_stamp_t alm_get_stamp(void)
     result = high_word + now;
     epicsInterruptUnlock(lock_key);
     return result;
+#endif
 }
 
 /*
  * Implementation of high-level interface starts here
  */
 
+/* true if called by the interrupt handler, i.e. from a callback */
+static int alm_handler_context(void)
+{
+#ifdef __linux__
+    return epicsThreadGetIdSelf() == alm_load_relaxed(alm_handler_thread);
+#else
+    return epicsInterruptIsInterruptContext();
+#endif
+}
+
+/*
+ * Start request made from a callback. The handler runs with interrupts
+ * locked (on Linux, the dispatcher thread holds the interrupt lock), and
+ * tasks lock interrupts while holding alm_lock, so alm_lock must not be
+ * taken here. Instead the request is handed over to the worker like a
+ * postponement, which re-files the alarm (see alm_refile). A non-zero
+ * <wall> makes it a wall clock alarm (see alm_start_at_epics).
+ */
+static void alm_start_deferred(alm_t what, alm_stamp_t due,
+    alm_delay_t period, alm_stamp_t wall)
+{
+    alm_store_release(what->active, 0);
+    if (what->group)
+        alm_store_relaxed(what->group_gen,
+            alm_load_relaxed(what->group->gen));
+    if (what->flags & ALM_STATS)
+        alm_increment(alm_stat_of(what)->starts);
+    what->time_postponed = due;
+    what->time_wall = wall;
+    alm_store_relaxed(what->period, period);
+    alm_store_relaxed(what->postponed, 1);
+    alm_work_push(what);                /* worker is woken at the end */
+}
+
+/*
+ * Start alarm with an absolute time due and period (both in internal
+ * time units, period 0 for a one-shot alarm).
+ */
+static void alm_start_due(alm_t what, alm_stamp_t due, alm_delay_t period)
+{
+    if (alm_handler_context()) {
+        alm_start_deferred(what, due, period, 0);
+        return;
+    }
+    alm_queue_enter();
+    alm_purge();                        /* remove inactive alarms */
+    alm_deactivate(what);               /* set alarm to inactive */
+    alm_remove(what);                   /* remove it from queue (if enqueued) */
+    if (what->group)                    /* no longer cancelled */
+        alm_store_relaxed(what->group_gen,
+            alm_load_relaxed(what->group->gen));
+    if (what->flags & ALM_STATS)
+        alm_increment(alm_stat_of(what)->starts);
+    alm_store_stamp(what->time_due, due);
+    alm_store_relaxed(what->period, period);
+    what->time_wall = 0;
+    alm_store_release(what->active, 1); /* callback sees prior writes */
+    alm_insert(what);                   /* insert it into queue */
+    if (alm_load_relaxed(what->active))
+        alm_setup_alarm(due, 0);        /* setup timer (if necessary) */
+    alm_queue_leave();
+}
+
 void unchecked_alm_start(alm_t what, alm_stamp_t delay)
 {
     alm_stamp_t tstart;
 
     /* to minimize errors, take the timestamp as early as possible */
-    tstart = alm_get_stamp();
+    tstart = alm_now();
 
-    epicsMutexMustLock(alm_lock);
-    alm_purge();                        /* remove inactive alarms */
-    alm_cancel(what);                   /* set alarm to inactive */
-    alm_remove(what);                   /* remove it from queue (if enqueued) */
     /* extremely long delays are simply ignored */
-    if (delay < MAX_DELAY) {
-        what->time_due = tstart + delay;    /* calculate time due */
-        what->active = 1;                   /* activate alarm */
-        alm_insert(what);                   /* insert it into queue */
-        if (what->active)
-            alm_setup_alarm(what->time_due, 0); /* setup timer (if necessary) */
+    if (delay < MAX_DELAY / usec_to_ticks(1)) {
+        alm_start_due(what, tstart + usec_to_ticks(delay), 0);
+    } else {
+        alm_cancel(what);
     }
-    epicsMutexUnlock(alm_lock);
 }
 
-/* insert alarm into queue, sorted by time due */
-static void alm_insert(alm_t what)
+void unchecked_alm_start_periodic(alm_t what, alm_delay_t delay,
+    alm_delay_t period)
 {
-    alm_t next = first_alm;
-    alm_t prev = 0;
+    alm_stamp_t tstart;
 
-    assert(!what->enqueued);
-    while (next && next->time_due <= what->time_due) {
-        prev = next;
-        next = next->next;
-    }
-    what->next = next;
-    what->enqueued = 1;
-    if (!prev) {
-        first_alm = what;
+    tstart = alm_now();
+
+    if (delay < MAX_DELAY / usec_to_ticks(1)
+            && period > 0 && period < MAX_DELAY / usec_to_ticks(1)) {
+        alm_start_due(what, tstart + usec_to_ticks(delay),
+            usec_to_ticks(period));
     } else {
-        prev->next = what;
+        alm_cancel(what);
     }
 }
 
-/* remove inactive alarms from head of queue */
-static void alm_purge()
+/*
+ * Sleeping
+ *
+ * Each thread that calls alm_sleep gets its own alarm and event on
+ * first use, which are kept in thread private storage and reused
+ * for all subsequent calls. They are freed when the thread exits
+ * (epicsAtThreadExit).
+ */
+struct alm_sleeper {
+    epicsEventId    ev;
+    alm_t           alm;
+};
+
+static epicsThreadPrivateId alm_sleeper_id;
+static unsigned long alm_sleepers;      /* allocated, for tests */
+
+static void alm_free_sleeper(void *arg)
 {
-    alm_t next = first_alm;
+    struct alm_sleeper *sl = (struct alm_sleeper *)arg;
 
-    while (next && !next->active) {
-        next->enqueued = 0;
-        next = next->next;
-    }
-    first_alm = next;
+    epicsThreadPrivateSet(alm_sleeper_id, 0);
+    alm_cancel_sync(sl->alm);           /* callback may still signal ev */
+    alm_destroy(sl->alm);
+    epicsEventDestroy(sl->ev);
+    free(sl);
+    alm_decrement(alm_sleepers);
 }
 
-/* remove alarm from queue, if enqueued */
-static void alm_remove(alm_t what)
+static struct alm_sleeper *alm_get_sleeper(void)
 {
-    alm_t next = first_alm;
-    alm_t prev = 0;
+    struct alm_sleeper *sl = epicsThreadPrivateGet(alm_sleeper_id);
 
-    assert(what);
-    if (!what->enqueued) {
-        return;
-    }
-    if (!first_alm) {
-        return;
+    if (sl) return sl;
+    sl = (struct alm_sleeper *) malloc(sizeof(struct alm_sleeper));
+    if (!sl) return NULL;
+    sl->ev = epicsEventCreate(epicsEventEmpty);
+    if (!sl->ev) {
+        free(sl);
+        return NULL;
     }
-    while (next && next != what) {
-        prev = next;
-        next = next->next;
+    sl->alm = alm_create_event(sl->ev);
+    if (!sl->alm) {
+        epicsEventDestroy(sl->ev);
+        free(sl);
+        return NULL;
     }
-    if (!prev) {                        /* found and first element in queue */
-        first_alm = what->next;
-    } else if (next) {                  /* found */
-        prev->next = what->next;
+    if (epicsAtThreadExit(alm_free_sleeper, sl) != 0) {
+        alm_destroy(sl->alm);
+        epicsEventDestroy(sl->ev);
+        free(sl);
+        return NULL;
     }
-    what->enqueued = 0;
+    epicsThreadPrivateSet(alm_sleeper_id, sl);
+    alm_increment(alm_sleepers);
+    return sl;
 }
 
-void unchecked_alm_cancel(alm_t alm)
+/* sleep until due (in internal time units) */
+static int alm_sleep_due(alm_stamp_t due)
 {
-    alm->active = 0;
+    struct alm_sleeper *sl = alm_get_sleeper();
+
+    if (!sl) return -1;
+    if (due <= alm_now()) return 0;
+    alm_start_due(sl->alm, due, 0);
+    epicsEventMustWait(sl->ev);
+    return 0;
 }
 
-alm_t alm_create(alm_callback *callback, void *arg)
+int unchecked_alm_sleep(alm_delay_t delay)
 {
-    alm_t alm = (alm_t) malloc(sizeof(struct alm_def));
+    alm_stamp_t tstart = alm_now();
 
-    if (!alm) return NULL;
-    alm->callback = callback;
-    alm->arg = arg;
-    alm->time_due = 0;
-    alm->active = 0;
-    alm->enqueued = 0;
-    alm->next = 0;
-    return alm;
+    if (delay >= MAX_DELAY / usec_to_ticks(1)) {
+        return -1;
+    }
+    return alm_sleep_due(tstart + usec_to_ticks(delay));
 }
 
-void alm_call_epics_event_signal(void *arg)
+int unchecked_alm_sleep_until(alm_stamp_t stamp)
 {
-    epicsEventSignal((epicsEventId)arg);
+    if (stamp >= MAX_DELAY / usec_to_ticks(1)) {
+        return -1;
+    }
+    return alm_sleep_due(usec_to_ticks(stamp));
+}
+
+/* insert alarm into queue, sorted by time due */
+static void alm_insert(alm_t what)
+{
+    alm_insert_from(0, what);
+}
+
+/*
+ * Expiry index maintenance, with alm_lock held. Changes are made to a
+ * copy of the published index (alm_index_edit), which alm_index_publish
+ * completes from the queue and publishes.
+ */
+static struct alm_index_def *alm_index_edit(void)
+{
+    struct alm_index_def *idx = alm_index_buf;
+    struct alm_index_def *held;
+
+    alm_fence_full();                   /* see alm_int_handler */
+    held = alm_load_acquire(alm_index_held);
+    while (idx == alm_index || idx == held) {
+        idx++;
+    }
+    memcpy(idx, alm_index, sizeof(struct alm_index_def));
+    return idx;
+}
+
+static void alm_index_publish(struct alm_index_def *idx)
+{
+    alm_t next = idx->count ? idx->alm[idx->count - 1]->next : first_alm;
+
+    while (next && idx->count < ALM_INDEX_SIZE) {
+        idx->due[idx->count] = next->time_due;
+        idx->alm[idx->count++] = next;
+        next = next->next;
+    }
+    alm_store_release(alm_index, idx);
+}
+
+/* drop <n> entries from position <pos> on */
+static void alm_index_drop(struct alm_index_def *idx, unsigned pos,
+    unsigned n)
+{
+    idx->count -= n;
+    memmove(idx->due + pos, idx->due + pos + n,
+        (idx->count - pos) * sizeof(alm_stamp_t));
+    memmove(idx->alm + pos, idx->alm + pos + n,
+        (idx->count - pos) * sizeof(alm_t));
+}
+
+/* position of enqueued alarm <what> in the index, ALM_INDEX_SIZE if not */
+static unsigned alm_index_find(alm_t what)
+{
+    const struct alm_index_def *idx = alm_index;
+    unsigned i = what->time_due ? alm_index_count(idx, what->time_due - 1) : 0;
+
+    for (; i < idx->count && idx->due[i] == what->time_due; i++) {
+        if (idx->alm[i] == what)
+            return i;
+    }
+    return ALM_INDEX_SIZE;
+}
+
+/* rebuild the index from the queue */
+static void alm_index_rebuild(void)
+{
+    struct alm_index_def *idx = alm_index_edit();
+
+    idx->count = 0;
+    alm_index_publish(idx);
+}
+
+/*
+ * Insert alarm into queue, starting the search at <prev> (or at the
+ * head of the queue if NULL). <prev> must be enqueued and not due
+ * later than <what>.
+ */
+static void alm_insert_from(alm_t prev, alm_t what)
+{
+    alm_t next;
+    struct alm_index_def *idx;
+    unsigned pos = alm_index_count(alm_index, what->time_due), i;
+
+    assert(!what->enqueued);
+    assert(!prev || (prev->enqueued && prev->time_due <= what->time_due));
+    if (pos && (pos < ALM_INDEX_SIZE || !prev)) {
+        prev = alm_index->alm[pos - 1]; /* last indexed one not later */
+    }
+    next = prev ? prev->next : first_alm;
+    while (next && next->time_due <= what->time_due) {
+        prev = next;
+        next = next->next;
+    }
+    alm_queue_modify();
+    alm_store_relaxed(what->next, next);
+    what->enqueued = 1;
+    /* publish: what must be complete before it becomes reachable */
+    if (!prev) {
+        alm_store_release(first_alm, what);
+    } else {
+        alm_store_release(prev->next, what);
+    }
+    if (pos < ALM_INDEX_SIZE) {
+        idx = alm_index_edit();
+        if (idx->count < ALM_INDEX_SIZE)
+            idx->count++;
+        for (i = idx->count - 1; i > pos; i--) {
+            idx->due[i] = idx->due[i - 1];
+            idx->alm[i] = idx->alm[i - 1];
+        }
+        idx->due[pos] = what->time_due;
+        idx->alm[pos] = what;
+        alm_index_publish(idx);
+    }
+}
+
+/* remove inactive alarms from head of queue */
+static void alm_purge()
+{
+    alm_t next = first_alm;
+    struct alm_index_def *idx;
+    unsigned n = 0;
+
+    while (next && (!alm_load_acquire(next->active) || alm_stale(next))) {
+        alm_store_release(next->active, 0);
+        next->enqueued = 0;
+        next = next->next;
+    }
+    if (next == first_alm) {
+        return;
+    }
+    alm_store_release(first_alm, next);
+    idx = alm_index_edit();
+    while (n < idx->count && idx->alm[n] != next) {
+        n++;
+    }
+    alm_index_drop(idx, 0, n);
+    alm_index_publish(idx);
+}
+
+/*
+ * Announce a change of an alarm's links or time due to the interrupt
+ * handler (see above). Must be called with alm_lock held, before the
+ * change.
+ */
+static void alm_queue_modify(void)
+{
+    alm_store_relaxed(alm_queue_gen, alm_queue_gen + 1);
+    alm_fence_release();
+}
+
+/*
+ * Lock the queue for a task: take alm_lock and tell the interrupt
+ * handler that the queue may be in use, so that it leaves re-filing
+ * periodic alarms to the worker (see alm_period_flush). The count is
+ * raised with interrupts locked, so an activation of the handler that
+ * sees it zero has finished before the task touches the queue (on
+ * Linux, the dispatcher thread holds the interrupt lock throughout).
+ * alm_lock is recursive, hence a count.
+ */
+static void alm_queue_enter(void)
+{
+    int key;
+
+    epicsMutexMustLock(alm_lock);
+    key = epicsInterruptLock();
+    alm_store_relaxed(alm_queue_busy, alm_queue_busy + 1);
+    epicsInterruptUnlock(key);
+}
+
+static void alm_queue_leave(void)
+{
+    alm_store_release(alm_queue_busy, alm_queue_busy - 1);
+    epicsMutexUnlock(alm_lock);
+}
+
+/* remove alarm from queue, if enqueued */
+static void alm_remove(alm_t what)
+{
+    alm_t next = first_alm;
+    alm_t prev = 0;
+    struct alm_index_def *idx;
+    unsigned pos;
+
+    assert(what);
+    /* the caller is going to change the alarm's time due */
+    alm_queue_modify();
+    if (!what->enqueued) {
+        return;
+    }
+    if (!first_alm) {
+        return;
+    }
+    pos = alm_index_find(what);
+    if (pos < ALM_INDEX_SIZE) {
+        prev = pos ? alm_index->alm[pos - 1] : 0;
+        next = what;
+    } else if (alm_index->count == ALM_INDEX_SIZE) {
+        prev = alm_index->alm[ALM_INDEX_SIZE - 1];
+        next = prev->next;
+    }
+    while (next && next != what) {
+        prev = next;
+        next = next->next;
+    }
+    if (!prev) {                        /* found and first element in queue */
+        alm_store_release(first_alm, what->next);
+    } else if (next) {                  /* found */
+        alm_store_release(prev->next, what->next);
+    }
+    what->enqueued = 0;
+    if (pos < ALM_INDEX_SIZE) {
+        idx = alm_index_edit();
+        alm_index_drop(idx, pos, 1);
+        alm_index_publish(idx);
+    }
+}
+
+/*
+ * Worker thread
+ *
+ * The interrupt handler pushes alarms onto the work list (in any order)
+ * and wakes up the worker, which processes them with alm_lock held.
+ */
+
+/* add alarm to work list, must be called with interrupts locked */
+static void alm_work_push(alm_t what)
+{
+    if (!what->work_pending) {
+        what->work_pending = 1;
+        what->work_next = alm_work_list;
+        alm_work_list = what;
+    }
+}
+
+/* remove alarm from work list, must be called with alm_lock held */
+static void alm_work_remove(alm_t what)
+{
+    int key = epicsInterruptLock();
+    alm_t *pnext = &alm_work_list;
+
+    while (*pnext && *pnext != what) {
+        pnext = &(*pnext)->work_next;
+    }
+    if (*pnext) {
+        *pnext = what->work_next;
+    }
+    what->work_pending = 0;
+    alm_store_relaxed(what->shed, 0);
+    epicsInterruptUnlock(key);
+}
+
+/*
+ * Schedule the next expiration of a periodic alarm that has just fired,
+ * called by the interrupt handler. The new deadline is derived from the
+ * old one, not from the current time, so that the period does not drift.
+ * If the handler is already late by one or more periods, these are
+ * skipped. The alarm is recorded as postponed to the new deadline; the
+ * handler re-files it at the end of the activation (alm_period_flush),
+ * otherwise (e.g. for an alarm shed to the worker) the worker does.
+ */
+static void alm_next_period(alm_t what, alm_stamp_t now)
+{
+    alm_delay_t period = alm_load_relaxed(what->period);
+    alm_stamp_t due;
+
+    if (!period) {
+        return;                         /* cancelled meanwhile */
+    }
+    due = what->time_due + period;
+    if (due <= now) {
+        alm_stats.overruns += (now - what->time_due) / period;
+        due = now - (now - what->time_due) % period + period;
+    }
+    what->time_postponed = due;
+    alm_store_relaxed(what->postponed, 1);
+    if (!alm_in_handler) {
+        alm_work_push(what);
+    } else if (!what->work_pending) {
+        what->work_pending = 1;
+        what->work_next = alm_period_list;
+        alm_period_list = what;
+    }
+}
+
+/*
+ * Re-insert an alarm whose deadline has been postponed, with the queue
+ * locked (alm_queue_enter, or by the handler, see alm_period_flush).
+ * Returns the new time due, 0 if the alarm was not re-filed.
+ */
+static alm_stamp_t alm_relink(alm_t what)
+{
+    alm_stamp_t due = 0;
+    int key = epicsInterruptLock();
+
+    if (alm_load_relaxed(what->postponed)
+            && !alm_load_relaxed(what->active) && !alm_stale(what)) {
+        due = what->time_postponed;
+    }
+    alm_store_relaxed(what->postponed, 0);
+    if (due && what->time_wall && !what->wall_listed) {
+        /* started with alm_start_at_epics from a callback */
+        what->wall_listed = 1;
+        what->wall_next = alm_wall_list;
+        alm_wall_list = what;
+    }
+    epicsInterruptUnlock(key);
+    if (due) {
+        alm_remove(what);
+        alm_store_stamp(what->time_due, due);
+        alm_store_relaxed(what->active, 1);
+        alm_insert(what);
+    }
+    return due;
+}
+
+/* re-insert an alarm whose deadline has been postponed */
+static void alm_refile(alm_t what)
+{
+    alm_stamp_t due = alm_relink(what);
+
+    if (due) {
+        alm_setup_alarm(due, 0);
+    }
+}
+
+/*
+ * Re-file the periodic alarms that fired in this activation of the
+ * interrupt handler (see alm_next_period). If no task holds the queue,
+ * the handler does this itself: it is the only one to touch the queue
+ * then. Otherwise the alarms are handed over to the worker. Returns the
+ * earlier of <due> and their new deadlines.
+ */
+static alm_stamp_t alm_period_flush(alm_stamp_t due)
+{
+    alm_t what;
+    alm_stamp_t next;
+    int own = !alm_load_acquire(alm_queue_busy);
+
+    while ((what = alm_period_list)) {
+        alm_period_list = what->work_next;
+        what->work_pending = 0;
+        if (!own) {
+            alm_work_push(what);
+            continue;
+        }
+        next = alm_relink(what);
+        if (next && next < due) {
+            due = next;
+        }
+    }
+    return due;
+}
+
+/* run the callback of an alarm shed by the interrupt handler */
+static void alm_run_shed(alm_t what)
+{
+    int key;
+
+    /* see alm_fire */
+    alm_store_relaxed(what->running, epicsThreadGetIdSelf());
+    alm_fence_full();
+    if (!alm_load_relaxed(what->shed) || alm_stale(what)) {
+        alm_store_release(what->running, 0);
+        return;                         /* cancelled meanwhile */
+    }
+    alm_store_relaxed(what->shed, 0);
+    if (alm_load_relaxed(what->miss_threshold)) {
+        key = epicsInterruptLock();
+        alm_miss_check(what);
+        epicsInterruptUnlock(key);
+    }
+    if (what->flags & ALM_STATS) {
+        alm_call_stats(what);
+    } else {
+        what->callback(what->arg);
+    }
+    alm_stats.fired++;
+    if (alm_load_relaxed(what->period)
+            && !alm_load_relaxed(what->active)) {
+        key = epicsInterruptLock();
+        alm_next_period(what, alm_now());
+        epicsInterruptUnlock(key);
+    }
+    alm_store_release(what->running, 0);
+}
+
+static void alm_work_run(void)
+{
+    alm_t what;
+    int key;
+
+    alm_queue_enter();
+    alm_purge();
+    for (;;) {
+        key = epicsInterruptLock();
+        what = alm_work_list;
+        if (what) {
+            alm_work_list = what->work_next;
+            what->work_pending = 0;
+        }
+        epicsInterruptUnlock(key);
+        if (!what) {
+            break;
+        }
+        if (alm_load_relaxed(what->shed)) {
+            alm_run_shed(what);
+        } else {
+            alm_refile(what);
+        }
+    }
+    alm_queue_leave();
+}
+
+/*
+ * Wall clock alarms
+ */
+
+#define WALL_CHECK_PERIOD 1.0           /* seconds between wall clock checks */
+#define WALL_TOLERANCE 100              /* accepted change of offset (us) */
+
+static alm_stamp_t alm_wall_offset;     /* wall clock - monotonic clock (us) */
+#ifdef ALM_TEST_WALL
+static long long alm_wall_skew;         /* added to wall clock, for tests */
+#else
+#define alm_wall_skew 0
+#endif
+
+/* wall clock in microseconds since the EPICS epoch */
+static alm_stamp_t alm_wall_now(void)
+{
+    epicsTimeStamp ts;
+
+    epicsTimeGetCurrent(&ts);
+    return (alm_stamp_t)ts.secPastEpoch * 1000000 + ts.nsec / 1000
+        + alm_wall_skew;
+}
+
+/*
+ * Convert a wall clock time (us) to a time due (internal time units),
+ * and record the current offset between the clocks.
+ */
+static alm_stamp_t alm_wall_to_due(alm_stamp_t wall)
+{
+    alm_stamp_t mono = alm_now();
+    alm_stamp_t now = alm_wall_now();
+
+    alm_wall_offset = now - ticks_to_usec(mono);
+    return wall > now ? mono + usec_to_ticks(wall - now) : mono;
+}
+
+/* remove alarm from wall list, must be called with alm_lock held */
+static void alm_wall_remove(alm_t what)
+{
+    alm_t *pnext = &alm_wall_list;
+
+    if (!what->wall_listed) {
+        return;
+    }
+    while (*pnext && *pnext != what) {
+        pnext = &(*pnext)->wall_next;
+    }
+    if (*pnext) {
+        *pnext = what->wall_next;
+    }
+    what->wall_listed = 0;
+}
+
+/*
+ * Check for a wall clock change and, if there was one, re-file all
+ * active wall clock alarms. Alarms that have been restarted relative
+ * to the monotonic clock or that are no longer active are dropped
+ * from the list. Must be called with alm_lock held.
+ */
+static void alm_wall_check(void)
+{
+    alm_stamp_t old = alm_wall_offset;
+    alm_stamp_t offset = alm_wall_now() - ticks_to_usec(alm_now());
+    alm_t *pnext = &alm_wall_list;
+    alm_t what, first = 0;
+    int key, was_active;
+
+    if (!alm_wall_list) {
+        return;
+    }
+    if (offset - old + WALL_TOLERANCE <= 2 * WALL_TOLERANCE) {
+        return;                         /* within tolerance */
+    }
+    alm_stats.clock_steps++;
+    alm_purge();
+    while ((what = *pnext) != 0) {
+        key = epicsInterruptLock();
+        was_active = what->active && what->time_wall && !alm_stale(what);
+        what->active = 0;
+        epicsInterruptUnlock(key);
+        if (!was_active) {
+            *pnext = what->wall_next;
+            what->wall_listed = 0;
+            continue;
+        }
+        alm_remove(what);
+        alm_store_stamp(what->time_due, alm_wall_to_due(what->time_wall));
+        alm_store_relaxed(what->active, 1);
+        alm_insert(what);
+        if (!first || what->time_due < first->time_due)
+            first = what;
+        pnext = &what->wall_next;
+    }
+    if (first)
+        alm_setup_alarm(first->time_due, 0);
+}
+
+void unchecked_alm_start_at_epics(alm_t what, const epicsTimeStamp *ts)
+{
+    alm_stamp_t wall = (alm_stamp_t)ts->secPastEpoch * 1000000
+        + ts->nsec / 1000;
+    alm_stamp_t now;
+
+    if (alm_handler_context()) {
+        /* like alm_wall_to_due, but alm_wall_offset is the worker's */
+        now = alm_wall_now();
+        alm_start_deferred(what, alm_now()
+            + (wall > now ? usec_to_ticks(wall - now) : 0), 0, wall);
+        return;
+    }
+    alm_queue_enter();
+    alm_start_due(what, alm_wall_to_due(wall), 0);
+    what->time_wall = wall;
+    if (!what->wall_listed) {
+        what->wall_listed = 1;
+        what->wall_next = alm_wall_list;
+        alm_wall_list = what;
+    }
+    alm_queue_leave();
+}
+
+static void alm_worker(void *arg)
+{
+    if (alm_rt)
+        alm_prefault_stack();
+    for (;;) {
+        epicsEventWaitWithTimeout(alm_work_event, WALL_CHECK_PERIOD);
+        alm_reclaim();
+        alm_work_run();
+        alm_queue_enter();
+        alm_miss_run();
+        alm_wall_check();
+        alm_queue_leave();
+    }
+}
+
+void unchecked_alm_postpone(alm_t what, alm_delay_t delay)
+{
+    alm_stamp_t due;
+    int key;
+
+    if (delay < MAX_DELAY / usec_to_ticks(1)) {
+        due = alm_now() + usec_to_ticks(delay);
+        key = epicsInterruptLock();
+        if (alm_load_relaxed(what->active) && !alm_stale(what)
+                && due >= what->time_due) {
+            if (due > what->time_due) {
+                what->time_postponed = due;
+                alm_store_relaxed(what->postponed, 1);
+            }
+            epicsInterruptUnlock(key);
+            return;
+        }
+        epicsInterruptUnlock(key);
+    }
+    /* not running or deadline moved forward: start normally */
+    unchecked_alm_start(what, delay);
+}
+
+void unchecked_alm_set_priority(alm_t what, alm_priority_t priority)
+{
+    what->priority = priority;
+    if (priority == ALM_PRIO_HIGH)
+        alm_prio_used = 1;
+}
+
+void unchecked_alm_set_miss_threshold(alm_t what, alm_delay_t threshold)
+{
+    alm_time_init();
+    alm_store_relaxed(what->miss_threshold, usec_to_ticks(threshold));
+}
+
+unsigned long unchecked_alm_get_misses(alm_t what)
+{
+    return alm_load_relaxed(what->misses);
+}
+
+void alm_set_miss_hook(alm_miss_hook *hook, void *user)
+{
+    alm_queue_enter();
+    alm_miss.hook = hook;
+    alm_miss.user = user;
+    alm_queue_leave();
+}
+
+void alm_set_budget(unsigned long count, alm_delay_t time)
+{
+    int key;
+
+    if (count > MAX_BUDGET_COUNT || time > MAX_BUDGET_TIME) {
+        errlogSevPrintf(errlogMinor,
+            "usage: alm_set_budget count time\n"
+            "  count in [0..%u] callbacks, time in [0..%u] us, 0 = unlimited\n",
+            MAX_BUDGET_COUNT, MAX_BUDGET_TIME);
+        return;
+    }
+    alm_time_init();
+    key = epicsInterruptLock();
+    alm_budget_count = count;
+    alm_budget_time = usec_to_ticks(time);
+    epicsInterruptUnlock(key);
+}
+
+void alm_set_spin_threshold(alm_delay_t threshold)
+{
+    if (threshold > MAX_SPIN_THRESHOLD) {
+        errlogSevPrintf(errlogMinor,
+            "alm_set_spin_threshold: threshold must be in [0..%u]\n",
+            MAX_SPIN_THRESHOLD);
+        return;
+    }
+    alm_time_init();
+    alm_spin_threshold = usec_to_ticks(threshold);
+}
+
+void alm_set_worker_priority(unsigned priority)
+{
+    if (priority > epicsThreadPriorityMax) {
+        errlogSevPrintf(errlogMinor,
+            "alm_set_worker_priority: priority must be in [%u..%u]\n",
+            (unsigned)epicsThreadPriorityMin,
+            (unsigned)epicsThreadPriorityMax);
+        return;
+    }
+    alm_worker_priority = priority;
+    if (alm_worker_id)
+        epicsThreadSetPriority(alm_worker_id, priority);
+}
+
+void alm_set_arm_tolerance(alm_delay_t tolerance)
+{
+    if (tolerance > MAX_ARM_TOLERANCE) {
+        errlogSevPrintf(errlogMinor,
+            "alm_set_arm_tolerance: tolerance must be in [0..%u]\n",
+            MAX_ARM_TOLERANCE);
+        return;
+    }
+    alm_time_init();
+    alm_arm_tolerance = usec_to_ticks(tolerance);
+}
+
+void alm_set_latency_offset(long offset)
+{
+    int key;
+
+    alm_time_init();
+    key = epicsInterruptLock();
+    if (offset < 0) {
+        alm_latency_fixed = 0;
+        alm_latency_offset = alm_latency.avg16 / LATENCY_WEIGHT;
+    } else {
+        alm_latency_fixed = 1;
+        alm_latency_offset = usec_to_ticks(offset);
+    }
+    epicsInterruptUnlock(key);
+}
+
+/* set alarm to inactive (it is removed from the queue later) */
+static void alm_deactivate(alm_t alm)
+{
+    alm_store_release(alm->active, 0);
+    alm_store_relaxed(alm->postponed, 0);
+    alm_store_relaxed(alm->period, 0);
+    alm_store_relaxed(alm->shed, 0);    /* drop pending shed callback */
+}
+
+void unchecked_alm_cancel(alm_t alm)
+{
+    if (alm->flags & ALM_STATS)
+        alm_increment(alm_stat_of(alm)->cancels);
+    alm_deactivate(alm);
+}
+
+static void alm_setup(alm_t alm, alm_callback *callback, void *arg,
+    unsigned flags)
+{
+    alm->callback = callback;
+    alm->arg = arg;
+    alm->time_due = 0;
+    alm->active = 0;
+    alm->enqueued = 0;
+    alm->next = 0;
+    alm->flags = flags;
+    alm->postponed = 0;
+    alm->time_postponed = 0;
+    alm->work_next = 0;
+    alm->work_pending = 0;
+    alm->shed = 0;
+    alm->priority = ALM_PRIO_NORMAL;
+    alm->period = 0;
+    alm->time_wall = 0;
+    alm->wall_next = 0;
+    alm->wall_listed = 0;
+    alm->miss_threshold = 0;
+    alm->misses = 0;
+    alm->group = 0;
+    alm->group_gen = 0;
+    alm->group_next = 0;
+    alm->group_prev = 0;
+    alm->running = 0;
+    alm->retire_next = 0;
+    alm->retired = 0;
+}
+
+alm_t alm_create(alm_callback *callback, void *arg)
+{
+    alm_t alm = (alm_t) malloc(sizeof(struct alm_def));
+
+    if (!alm) return NULL;
+    alm_setup(alm, callback, arg, 0);
+    return alm;
+}
+
+alm_t alm_create_ex(alm_callback *callback, void *arg, unsigned flags)
+{
+    alm_t alm;
+
+    if (!(flags & ALM_CREATE_STATS)) {
+        return alm_create(callback, arg);
+    }
+    alm = (alm_t) malloc(sizeof(struct alm_def) + sizeof(struct alm_stat_def));
+    if (!alm) return NULL;
+    alm_setup(alm, callback, arg, ALM_STATS);
+    memset(alm_stat_of(alm), 0, sizeof(struct alm_stat_def));
+    return alm;
+}
+
+int unchecked_alm_get_stats(alm_t alm, alm_stats_t *stats)
+{
+    struct alm_stat_def *st = alm_stat_of(alm);
+
+    if (!(alm->flags & ALM_STATS)) {
+        return -1;
+    }
+    alm_time_init();
+    stats->starts = alm_load_relaxed(st->starts);
+    stats->fires = alm_load_relaxed(st->fires);
+    stats->cancels = alm_load_relaxed(st->cancels);
+    stats->latency_last = ticks_to_usec(alm_load_relaxed(st->latency_last));
+    stats->latency_max = ticks_to_usec(alm_load_relaxed(st->latency_max));
+    stats->duration_last = ticks_to_usec(alm_load_relaxed(st->duration_last));
+    return 0;
+}
+
+/*
+ * EPICS callback alarms
+ *
+ * The alarm's callback only links the alarm into the pending list for
+ * its callback priority. At the end of each activation the interrupt
+ * handler requests one batch CALLBACK per priority with pending alarms
+ * (unless that batch is still queued), which then runs all user
+ * callbacks collected so far on the callback thread. The alm_cb_def
+ * is allocated together with the alarm, directly behind it.
+ */
+struct alm_cb_def {
+    CALLBACK            *pcb;
+    int                 priority;
+    int                 pending;        /* in pending list */
+    struct alm_cb_def   *next;          /* link in pending list */
+    struct alm_cb_def   *run_next;      /* link in running batch */
+};
+
+static struct {
+    CALLBACK            batch;
+    struct alm_cb_def   *pending;       /* most recent first */
+    int                 requested;      /* batch has been requested */
+} alm_cb_queue[NUM_CALLBACK_PRIORITIES];
+
+static int alm_cb_any;                  /* some pending list not empty */
+static epicsMutexId alm_cb_lock;        /* held while running a batch */
+
+#define alm_cb_of(alm) ((struct alm_cb_def *)((alm) + 1))
+
+/* alarm callback, runs in interrupt context */
+static void alm_cb_fire(void *arg)
+{
+    struct alm_cb_def *cb = (struct alm_cb_def *)arg;
+
+    if (!cb->pending) {
+        cb->pending = 1;
+        cb->next = alm_cb_queue[cb->priority].pending;
+        alm_cb_queue[cb->priority].pending = cb;
+        alm_cb_any = 1;
+        alm_stats.cb_queued++;
+    }
+}
+
+/* request batches for all priorities, called by the interrupt handler */
+static void alm_cb_flush(void)
+{
+    int prio;
+
+    if (!alm_cb_any) return;
+    alm_cb_any = 0;
+    for (prio = 0; prio < NUM_CALLBACK_PRIORITIES; prio++) {
+        if (alm_cb_queue[prio].pending && !alm_cb_queue[prio].requested) {
+            alm_cb_queue[prio].requested = 1;
+            callbackRequest(&alm_cb_queue[prio].batch);
+            alm_stats.cb_requests++;
+        }
+    }
+}
+
+/*
+ * Batch callback, runs on the callback thread. Once detached, an alarm
+ * is no longer pending: if it expires again before its callback has
+ * been called, the handler links it into the pending list anew (for
+ * the next batch) and overwrites its next link, so the batch is linked
+ * through run_next instead.
+ */
+static void alm_cb_run(CALLBACK *batch)
+{
+    struct alm_cb_def *cb, *next, *run = 0;
+    int prio = batch->priority;
+    int key;
+
+    epicsMutexMustLock(alm_cb_lock);
+    key = epicsInterruptLock();
+    /* reverse to call in order of expiration */
+    for (cb = alm_cb_queue[prio].pending; cb; cb = cb->next) {
+        cb->pending = 0;
+        cb->run_next = run;
+        run = cb;
+    }
+    alm_cb_queue[prio].pending = 0;
+    alm_cb_queue[prio].requested = 0;
+    epicsInterruptUnlock(key);
+    for (cb = run; cb; cb = next) {
+        next = cb->run_next;
+        cb->pcb->callback(cb->pcb);
+    }
+    epicsMutexUnlock(alm_cb_lock);
+}
+
+/* remove from pending list, called before an alarm is freed */
+static void alm_cb_remove(struct alm_cb_def *what)
+{
+    struct alm_cb_def **pnext = &alm_cb_queue[what->priority].pending;
+    int key;
+
+    epicsMutexMustLock(alm_cb_lock);
+    key = epicsInterruptLock();
+    while (*pnext && *pnext != what) {
+        pnext = &(*pnext)->next;
+    }
+    if (*pnext) {
+        *pnext = what->next;
+    }
+    what->pending = 0;
+    epicsInterruptUnlock(key);
+    epicsMutexUnlock(alm_cb_lock);
+}
+
+void unchecked_alm_cancel_sync(alm_t alm)
+{
+    epicsThreadId runner;
+
+    unchecked_alm_cancel(alm);
+    alm_fence_full();                   /* see alm_fire */
+    runner = alm_load_acquire(alm->running);
+    if (runner && runner != epicsThreadGetIdSelf()) {
+        /*
+         * Sleep rather than yield: the runner may be the worker thread,
+         * which usually has a lower priority than the caller and would
+         * never get the CPU back from a yielding loop.
+         */
+        do {
+            epicsThreadSleep(epicsThreadSleepQuantum());
+        } while (alm_load_acquire(alm->running));
+    }
+    /* a periodic callback may have scheduled its next expiration */
+    alm_deactivate(alm);
+    if (alm->flags & ALM_CALLBACK) {
+        /* drop a queued request, wait for a running batch */
+        alm_cb_remove(alm_cb_of(alm));
+    }
+}
+
+alm_t unchecked_alm_create_callback(CALLBACK *pcb, int priority)
+{
+    alm_t alm;
+    struct alm_cb_def *cb;
+
+    if (priority < 0 || priority >= NUM_CALLBACK_PRIORITIES) {
+        return NULL;
+    }
+    alm = (alm_t) malloc(sizeof(struct alm_def) + sizeof(struct alm_cb_def));
+    if (!alm) return NULL;
+    cb = alm_cb_of(alm);
+    cb->pcb = pcb;
+    cb->priority = priority;
+    cb->pending = 0;
+    cb->next = 0;
+    alm_setup(alm, alm_cb_fire, cb, ALM_CALLBACK);
+    return alm;
+}
+
+alm_t alm_init_static(alm_storage_t *storage, alm_callback *callback,
+    void *arg)
+{
+    alm_t alm = (alm_t) storage;
+
+    assert(storage);
+    alm_setup(alm, callback, arg, ALM_STATIC);
+    return alm;
+}
+
+void alm_call_epics_event_signal(void *arg)
+{
+    epicsEventSignal((epicsEventId)arg);
 }
 
 alm_t alm_create_event(epicsEventId ev)
 {
-    return alm_create(alm_call_epics_event_signal, ev);
+    return alm_create(alm_call_epics_event_signal, ev);
+}
+
+/*
+ * Alarm groups
+ */
+
+/* remove alarm from its group's member list, with alm_lock held */
+static void alm_group_unlink(alm_t alm)
+{
+    if (!alm->group) {
+        return;
+    }
+    if (alm->group_prev) {
+        alm->group_prev->group_next = alm->group_next;
+    } else {
+        alm->group->members = alm->group_next;
+    }
+    if (alm->group_next) {
+        alm->group_next->group_prev = alm->group_prev;
+    }
+    alm->group_next = alm->group_prev = 0;
+}
+
+alm_group_t alm_group_create(void)
+{
+    alm_group_t group = calloc(1, sizeof(struct alm_group_def));
+
+    if (!group) return NULL;
+    group->refs = 1;
+    return group;
+}
+
+/* drop a reference, see struct alm_group_def */
+static void alm_group_put(alm_group_t group)
+{
+    if (alm_decrement(group->refs) == 0) {
+        alm_fence_acquire();            /* see the other references' drops */
+        free(group);
+    }
+}
+
+alm_t unchecked_alm_create_in(alm_group_t group, alm_callback *callback,
+    void *arg)
+{
+    alm_t alm = alm_create(callback, arg);
+
+    if (!alm) return NULL;
+    alm_queue_enter();
+    alm->group = group;
+    alm->group_gen = group->gen;
+    alm->group_next = group->members;
+    if (group->members) {
+        group->members->group_prev = alm;
+    }
+    group->members = alm;
+    alm_increment(group->refs);
+    alm_queue_leave();
+    return alm;
+}
+
+void unchecked_alm_group_cancel(alm_group_t group)
+{
+    alm_increment(group->gen);
+}
+
+/*
+ * Retire all members like alm_destroy, so that the worker unlinks them
+ * in one pass over the queue and frees them after a grace period. The
+ * group itself is freed with its last member (see alm_group_put).
+ */
+void unchecked_alm_group_destroy(alm_group_t group)
+{
+    alm_t alm;
+    int wake = 0;
+
+    alm_increment(group->gen);          /* members must not fire any more */
+    alm_queue_enter();
+    for (alm = group->members; alm; alm = alm->group_next) {
+        if (alm_load_relaxed(alm->retired)) {
+            continue;                   /* destroyed before */
+        }
+        alm_deactivate(alm);
+        alm_store_relaxed(alm->retired, 1);
+        wake |= alm_retire_push(alm);
+    }
+    alm_queue_leave();
+    if (wake) {
+        epicsEventSignal(alm_work_event);
+    }
+    alm_group_put(group);
+}
+
+/* cancel alarm and remove it from the queue */
+static void alm_release(alm_t alm)
+{
+    int key;
+
+    alm_deactivate(alm);
+    if (init_state == ALM_INIT_OK) {
+        alm_queue_enter();
+        alm_remove(alm);
+        alm_work_remove(alm);
+        alm_wall_remove(alm);
+        alm_group_unlink(alm);
+        /*
+         * Even if no longer (or never) linked, the interrupt handler
+         * may still be looking at the alarm: wait until a running
+         * activation has finished. Then no new miss records can appear.
+         */
+        key = epicsInterruptLock();
+        alm_miss_forget(alm);
+        epicsInterruptUnlock(key);
+        alm_queue_leave();
+    }
+    assert(!alm->active);
+    assert(!alm->enqueued);
+    assert(!alm->work_pending);
+    assert(!alm->wall_listed);
+}
+
+/*
+ * Retired alarms
+ *
+ * alm_destroy only deactivates the alarm and pushes it onto the retire
+ * list, without locking and without scanning the queue. The worker then
+ * unlinks all retired alarms in one pass over the queue (alm_reclaim)
+ * and frees them after a grace period: once alm_epoch has changed (or
+ * if it was even, i.e. the handler was not running), no activation of
+ * the handler that might have seen them is left.
+ */
+
+/* wait until a running activation of the handler has finished */
+static void alm_grace_period(void)
+{
+    unsigned long epoch;
+
+    alm_fence_full();
+    epoch = alm_load_acquire(alm_epoch);
+    if (epoch & 1) {
+        while (alm_load_acquire(alm_epoch) == epoch) {
+            epicsThreadSleep(0.0);
+        }
+    }
+}
+
+/* push alarm onto the retire list, return true if it was empty */
+static int alm_retire_push(alm_t alm)
+{
+    alm_t head;
+#ifdef alm_cas_release
+    head = alm_load_relaxed(alm_retire_list);
+    do {
+        alm->retire_next = head;
+    } while (!alm_cas_release(alm_retire_list, head, alm));
+#else
+    int key = epicsInterruptLock();
+
+    head = alm_retire_list;
+    alm->retire_next = head;
+    alm_retire_list = alm;
+    epicsInterruptUnlock(key);
+#endif
+    return !head;
+}
+
+/* take all alarms from the retire list */
+static alm_t alm_retire_take(void)
+{
+#ifdef alm_exchange_acquire
+    return alm_exchange_acquire(alm_retire_list, 0);
+#else
+    int key = epicsInterruptLock();
+    alm_t list = alm_retire_list;
+
+    alm_retire_list = 0;
+    epicsInterruptUnlock(key);
+    return list;
+#endif
+}
+
+/*
+ * Unlink and free retired alarms. Must be called without alm_lock held:
+ * callbacks the handler is running may need it to start alarms.
+ */
+static void alm_reclaim(void)
+{
+    alm_t list = alm_retire_take();
+    alm_t alm, next, prev = 0;
+    int key, enqueued = 0;
+
+    if (!list) {
+        return;
+    }
+    alm_queue_enter();
+    for (alm = list; alm; alm = alm->retire_next) {
+        alm_deactivate(alm);            /* in case a callback restarted it */
+        alm_work_remove(alm);
+        alm_wall_remove(alm);
+        alm_group_unlink(alm);
+        enqueued |= alm->enqueued;
+    }
+    if (enqueued) {
+        alm_queue_modify();
+        for (alm = first_alm; alm; alm = next) {
+            next = alm->next;
+            if (!alm_load_relaxed(alm->retired)) {
+                prev = alm;
+                continue;
+            }
+            if (prev) {
+                alm_store_release(prev->next, next);
+            } else {
+                alm_store_release(first_alm, next);
+            }
+            alm->enqueued = 0;
+        }
+        alm_index_rebuild();
+    }
+    alm_queue_leave();
+    alm_grace_period();
+
+    alm_queue_enter();
+    key = epicsInterruptLock();
+    for (alm = list; alm; alm = alm->retire_next) {
+        alm_miss_forget(alm);
+    }
+    epicsInterruptUnlock(key);
+    for (alm = list; alm; alm = alm->retire_next) {
+        alm_work_remove(alm);           /* pushed by the last activation */
+    }
+    alm_queue_leave();
+    for (alm = list; alm; alm = next) {
+        next = alm->retire_next;
+        if (alm->flags & ALM_CALLBACK) {
+            alm_cb_remove(alm_cb_of(alm));
+        }
+        if (alm->group) {
+            alm_group_put(alm->group);
+        }
+        free(alm);
+    }
+}
+
+void unchecked_alm_destroy(alm_t alm)
+{
+    assert(!(alm->flags & ALM_STATIC));
+    if (alm->flags & ALM_BATCH) {
+        alm_batch_leave(alm);
+    }
+    if (init_state != ALM_INIT_OK) {
+        alm_release(alm);               /* no worker, nothing queued */
+        if (alm->flags & ALM_CALLBACK) {
+            alm_cb_remove(alm_cb_of(alm));
+        }
+        free(alm);
+        return;
+    }
+    alm_deactivate(alm);
+    alm_store_relaxed(alm->retired, 1);
+    if (alm_retire_push(alm)) {
+        epicsEventSignal(alm_work_event);
+    }
+}
+
+void unchecked_alm_fini_static(alm_t alm)
+{
+    assert(alm->flags & ALM_STATIC);
+    alm_release(alm);
+}
+
+/*
+ * Batches
+ *
+ * A member's callback only stores its arg in the batch's args array and
+ * links the batch into the pending list. Before it re-checks the queue
+ * for the last time, the interrupt handler calls the callback of each
+ * pending batch once (alm_batch_flush). The args array is only used by
+ * the handler; the alm_batch_member is allocated together with the
+ * alarm, directly behind it. The members stay marked as running (see
+ * alm_cancel_sync) until the batch callback has consumed their args.
+ * Members are never shed to the worker (see alm_defer), so the batch
+ * callback is only ever called by the handler, one call at a time.
+ */
+struct alm_batch_def {
+    alm_batch_callback  *callback;
+    size_t              capacity;
+    size_t              num;            /* args collected */
+    unsigned long       members;        /* not yet destroyed */
+    int                 pending;        /* in pending list */
+    struct alm_batch_def *next;         /* link in pending list */
+    alm_t               *alms;          /* members the args belong to */
+    void                *args[1];       /* actually capacity elements */
+};
+
+struct alm_batch_member {
+    alm_batch_t         batch;
+    void                *arg;
+};
+
+static alm_batch_t alm_batch_pending;   /* most recent first */
+
+#define alm_member_of(alm) ((struct alm_batch_member *)((alm) + 1))
+#define alm_of_member(member) (((alm_t)(member)) - 1)
+
+/* call the batch callback with the args collected so far */
+static void alm_batch_call(alm_batch_t batch)
+{
+    size_t n;
+
+    batch->callback(batch->args, batch->num);
+    for (n = 0; n < batch->num; n++) {
+        alm_store_release(batch->alms[n]->running, 0);
+    }
+    batch->num = 0;
+    alm_stats.batch_calls++;
+}
+
+/* alarm callback, runs in interrupt context */
+static void alm_batch_fire(void *arg)
+{
+    struct alm_batch_member *member = (struct alm_batch_member *)arg;
+    alm_batch_t batch = member->batch;
+
+    if (batch->num == batch->capacity) {
+        alm_batch_call(batch);          /* full */
+    }
+    batch->alms[batch->num] = alm_of_member(member);
+    batch->args[batch->num++] = member->arg;
+    if (!batch->pending) {
+        batch->pending = 1;
+        batch->next = alm_batch_pending;
+        alm_batch_pending = batch;
+    }
+    alm_stats.batch_queued++;
+}
+
+/* call all pending batches, called by the interrupt handler */
+static void alm_batch_flush(void)
+{
+    alm_batch_t batch;
+
+    while ((batch = alm_batch_pending) != 0) {
+        alm_batch_pending = batch->next;
+        batch->pending = 0;
+        alm_batch_call(batch);
+    }
+}
+
+/* member is being destroyed, see alm_batch_destroy */
+static void alm_batch_leave(alm_t alm)
+{
+    alm_decrement(alm_member_of(alm)->batch->members);
+}
+
+alm_batch_t alm_batch_create(alm_batch_callback *callback, size_t capacity)
+{
+    alm_batch_t batch;
+
+    if (!callback || !capacity) {
+        return NULL;
+    }
+    batch = (alm_batch_t) calloc(1, sizeof(struct alm_batch_def)
+        + (capacity - 1) * sizeof(void *) + capacity * sizeof(alm_t));
+    if (!batch) return NULL;
+    batch->alms = (alm_t *)(batch->args + capacity);
+    batch->callback = callback;
+    batch->capacity = capacity;
+    return batch;
+}
+
+alm_t unchecked_alm_create_batch(alm_batch_t batch, void *arg)
+{
+    alm_t alm;
+    struct alm_batch_member *member;
+
+    alm = (alm_t) malloc(sizeof(struct alm_def)
+        + sizeof(struct alm_batch_member));
+    if (!alm) return NULL;
+    member = alm_member_of(alm);
+    member->batch = batch;
+    member->arg = arg;
+    alm_setup(alm, alm_batch_fire, member, ALM_BATCH);
+    alm_increment(batch->members);
+    return alm;
+}
+
+int unchecked_alm_batch_destroy(alm_batch_t batch)
+{
+    unsigned long members = alm_load_acquire(batch->members);
+
+    if (members) {
+        errlogSevPrintf(errlogMinor,
+            "alm_batch_destroy: batch still has %lu members\n", members);
+        return -1;
+    }
+    /* destroyed members may still be firing in the handler */
+    alm_grace_period();
+    free(batch);
+    return 0;
+}
+
+/*
+ * Sequences
+ *
+ * Each step has its own embedded alarm. alm_sequence_start computes all
+ * deadlines from a single start time and inserts the alarms in one pass
+ * through the queue (steps are sorted by offset, so each insertion
+ * continues where the previous one ended). The dispatcher then fires the
+ * steps like any other alarm; nothing is re-armed from callbacks.
+ */
+struct alm_seq_slot {
+    struct alm_def      alm;
+    alm_seq_t           seq;
+    alm_seq_step_t      step;
+    alm_delay_t         offset;         /* step.offset in internal units */
+    alm_stamp_t         fired;          /* when last fired, 0 if not yet */
+    alm_delay_t         max_jitter;     /* max interval error, see below */
+};
+
+struct alm_seq_def {
+    unsigned            num;
+    unsigned long       runs;           /* number of starts */
+    alm_stamp_t         start;          /* time of offset 0 */
+    struct alm_seq_slot slot[1];        /* actually num elements */
+};
+
+/*
+ * Record the fire time and the deviation of the interval to the previous
+ * step (or to the start time for the first step) from the nominal one,
+ * then call the step's callback.
+ */
+static void alm_seq_fire(void *arg)
+{
+    struct alm_seq_slot *slot = (struct alm_seq_slot *)arg;
+    alm_seq_t seq = slot->seq;
+    alm_stamp_t prev;
+    alm_delay_t interval, nominal, error;
+
+    slot->fired = alm_now();
+    if (slot == seq->slot) {
+        prev = seq->start;
+        nominal = slot->offset;
+    } else {
+        prev = slot[-1].fired;
+        nominal = slot->offset - slot[-1].offset;
+    }
+    if (prev) {
+        interval = slot->fired - prev;
+        error = interval > nominal ? interval - nominal : nominal - interval;
+        if (error > slot->max_jitter)
+            slot->max_jitter = error;
+    }
+    slot->step.callback(slot->step.arg);
+}
+
+alm_seq_t alm_sequence_create(const alm_seq_step_t *steps, unsigned num)
+{
+    alm_seq_t seq;
+    struct alm_seq_slot tmp;
+    unsigned n, k;
+
+    if (!num) return NULL;
+    seq = (alm_seq_t) calloc(1, sizeof(struct alm_seq_def)
+        + (num - 1) * sizeof(struct alm_seq_slot));
+    if (!seq) return NULL;
+    alm_time_init();
+    seq->num = num;
+    /* insertion sort by offset, keeps order of steps with equal offset */
+    for (n = 0; n < num; n++) {
+        tmp.step = steps[n];
+        for (k = n; k > 0 && seq->slot[k-1].step.offset > tmp.step.offset;
+                k--) {
+            seq->slot[k].step = seq->slot[k-1].step;
+        }
+        seq->slot[k].step = tmp.step;
+    }
+    for (n = 0; n < num; n++) {
+        struct alm_seq_slot *slot = &seq->slot[n];
+
+        alm_setup(&slot->alm, alm_seq_fire, slot, ALM_STATIC);
+        slot->seq = seq;
+        slot->offset = usec_to_ticks(slot->step.offset);
+    }
+    return seq;
+}
+
+void unchecked_alm_sequence_start(alm_seq_t seq, alm_delay_t delay)
+{
+    alm_stamp_t tstart;
+    alm_t prev = 0;
+    unsigned n;
+
+    tstart = alm_now();
+
+    if (alm_handler_context()) {
+        /* alm_lock must not be taken, see alm_start_deferred */
+        if (delay >= MAX_DELAY / usec_to_ticks(1)
+                || seq->slot[seq->num-1].step.offset
+                    >= MAX_DELAY / usec_to_ticks(1) - delay) {
+            unchecked_alm_sequence_cancel(seq);
+            return;
+        }
+        seq->start = tstart + usec_to_ticks(delay);
+        seq->runs++;
+        for (n = 0; n < seq->num; n++) {
+            struct alm_seq_slot *slot = &seq->slot[n];
+
+            slot->fired = 0;
+            alm_start_deferred(&slot->alm, seq->start + slot->offset, 0, 0);
+        }
+        return;
+    }
+    alm_queue_enter();
+    alm_purge();
+    for (n = 0; n < seq->num; n++) {
+        alm_cancel(&seq->slot[n].alm);
+        alm_remove(&seq->slot[n].alm);
+    }
+    if (delay < MAX_DELAY / usec_to_ticks(1)
+            && seq->slot[seq->num-1].step.offset
+                < MAX_DELAY / usec_to_ticks(1) - delay) {
+        seq->start = tstart + usec_to_ticks(delay);
+        seq->runs++;
+        for (n = 0; n < seq->num; n++) {
+            struct alm_seq_slot *slot = &seq->slot[n];
+
+            slot->fired = 0;
+            alm_store_stamp(slot->alm.time_due, seq->start + slot->offset);
+            alm_store_release(slot->alm.active, 1);
+            alm_insert_from(prev, &slot->alm);
+            prev = &slot->alm;
+        }
+        alm_setup_alarm(seq->start + seq->slot[0].offset, 0);
+    }
+    alm_queue_leave();
+}
+
+void unchecked_alm_sequence_cancel(alm_seq_t seq)
+{
+    unsigned n;
+
+    for (n = 0; n < seq->num; n++) {
+        alm_cancel(&seq->slot[n].alm);
+    }
+}
+
+void unchecked_alm_sequence_destroy(alm_seq_t seq)
+{
+    unsigned n;
+
+    for (n = 0; n < seq->num; n++) {
+        alm_release(&seq->slot[n].alm);
+    }
+    free(seq);
+}
+
+void alm_sequence_dump(alm_seq_t seq)
+{
+    unsigned n;
+
+    if (!seq) {
+        printf("<NULL>\n");
+        return;
+    }
+    printf("%p:steps=%u,runs=%lu\n", seq, seq->num, seq->runs);
+    for (n = 0; n < seq->num; n++) {
+        struct alm_seq_slot *slot = &seq->slot[n];
+        long error = 0;
+
+        if (slot->fired) {
+            error = (long)ticks_to_nsec(slot->fired - seq->start)
+                - (long)ticks_to_nsec(slot->offset);
+        }
+        printf("step %u: offset=%lu, %s, error=%ldns, max_jitter=%luns\n",
+            n, (unsigned long)slot->step.offset,
+            slot->fired ? "fired" : (slot->alm.active ? "pending" : "idle"),
+            error, (unsigned long)ticks_to_nsec(slot->max_jitter));
+    }
+}
+
+void alm_calibrate(unsigned num)
+{
+    epicsEventId ev;
+    alm_t alm;
+    int key;
+
+    if (init_state != ALM_INIT_OK) {
+        return;
+    }
+    ev = epicsEventCreate(epicsEventEmpty);
+    if (!ev) {
+        return;
+    }
+    alm = alm_create_event(ev);
+    if (!alm) {
+        epicsEventDestroy(ev);
+        return;
+    }
+    key = epicsInterruptLock();
+    alm_latency.samples = 0;
+    alm_latency.avg16 = 0;
+    alm_latency.max = 0;
+    epicsInterruptUnlock(key);
+    while (num--) {
+        alm_start(alm, CALIBRATION_DELAY);
+        epicsEventWait(ev);
+    }
+    key = epicsInterruptLock();
+    alm_latency_offset = alm_latency.avg16 / LATENCY_WEIGHT;
+    epicsInterruptUnlock(key);
+    alm_destroy(alm);
+    epicsEventDestroy(ev);
+}
+
+alm_init_state_t alm_init_state(void)
+{
+    return init_state;
+}
+
+#ifdef __linux__
+/*
+ * Real-time hardening (see alm_init_ex). With ALM_INIT_RT_HEAP, freed
+ * memory is kept in the heap and large blocks are not mmap'ed separately,
+ * so that the prefaulted reserve is reused by later allocations (e.g.
+ * alm_create). These malloc settings apply to the whole process. Note
+ * that threads may allocate from other malloc arenas; these are covered
+ * by MCL_FUTURE only.
+ */
+static void alm_rt_harden(unsigned flags)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    char *reserve;
+    size_t n;
+
+    if (flags & ALM_INIT_RT_HEAP) {
+        mallopt(M_TRIM_THRESHOLD, -1);
+        mallopt(M_MMAP_MAX, 0);
+    }
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        errlogSevPrintf(errlogMinor,
+            "alm_init: mlockall failed (%s), memory is only prefaulted\n",
+            strerror(errno));
+    }
+    if (flags & ALM_INIT_RT_HEAP) {
+        reserve = (char *) malloc(RT_HEAP_RESERVE);
+        if (reserve) {
+            for (n = 0; n < RT_HEAP_RESERVE; n += page)
+                ((volatile char *)reserve)[n] = 0;
+            free(reserve);
+        }
+    }
+    alm_prefault_stack();
+}
+#else
+#define alm_rt_harden(flags)
+#endif
+
+alm_init_state_t alm_init_ex(int intLevel, unsigned flags)
+{
+    int key = epicsInterruptLock();                /* lock interrupts during init */
+    int prio;
+
+    if (init_state != ALM_NO_INIT) {
+        goto done;
+    }
+    init_state = ALM_INIT_FAILED;       /* assume init failes */
+    alm_time_init();
+    timer_set_int_level(intLevel);
+    alm_lock = epicsMutexCreate();
+    if (!alm_lock) {
+        errlogSevPrintf(errlogFatal,
+            "alm_init: semMCreate failed\n");
+        goto done;
+    }
+    alm_sleeper_id = epicsThreadPrivateCreate();
+    if (!alm_sleeper_id) {
+        errlogSevPrintf(errlogFatal,
+            "alm_init: epicsThreadPrivateCreate failed\n");
+        goto done;
+    }
+    alm_cb_lock = epicsMutexCreate();
+    if (!alm_cb_lock) {
+        errlogSevPrintf(errlogFatal,
+            "alm_init: semMCreate failed\n");
+        goto done;
+    }
+    for (prio = 0; prio < NUM_CALLBACK_PRIORITIES; prio++) {
+        callbackSetCallback(alm_cb_run, &alm_cb_queue[prio].batch);
+        callbackSetPriority(prio, &alm_cb_queue[prio].batch);
+    }
+    alm_work_event = epicsEventCreate(epicsEventEmpty);
+    if (!alm_work_event) {
+        errlogSevPrintf(errlogFatal,
+            "alm_init: epicsEventCreate failed\n");
+        goto done;
+    }
+    if (timer_install_int_routine(alm_int_handler))
+    {
+        errlogSevPrintf(errlogFatal, "alm_init: devConnectInterrupt failed\n");
+	goto done;
+    }
+    alm_rt = (flags & ALM_INIT_RT) != 0;
+    timer_enable();
+    alm_setup_alarm(alm_now() + usec_to_ticks(MAX_WAIT), 0);
+    epicsInterruptUnlock(key);
+
+    /*
+     * Threads cannot be created with interrupts locked. Until the worker
+     * runs, the state stays ALM_INIT_FAILED, so that no alarm can be
+     * started that would depend on it; without it, stop the timer again.
+     */
+    if (alm_rt)
+        alm_rt_harden(flags);           /* before creating the worker */
+    alm_worker_id = epicsThreadCreate("almWorker", alm_worker_priority,
+        epicsThreadGetStackSize(epicsThreadStackMedium), alm_worker, 0);
+    if (!alm_worker_id) {
+        errlogSevPrintf(errlogFatal,
+            "alm_init: cannot create worker thread\n");
+        key = epicsInterruptLock();
+        timer_disable();
+        epicsInterruptUnlock(key);
+        return init_state;
+    }
+    init_state = ALM_INIT_OK;           /* success */
+    if (flags & ALM_INIT_CALIBRATE)
+        alm_calibrate(CALIBRATION_SAMPLES);
+    return init_state;
+
+done:
+    epicsInterruptUnlock(key);
+    return init_state;
+}
+
+int alm_init(int intLevel)
+{
+    return alm_init_ex(intLevel, 0);
+}
+
+/*
+ * Queue snapshots
+ *
+ * The queue is copied into an array while holding alm_lock (without
+ * doing any output or allocation), formatting is done afterwards.
+ */
+struct alm_snap_entry {
+    alm_t           alm;
+    alm_stamp_t     due;
+    int             active;
+    int             enqueued;
+    alm_t           next;
+    int             priority;
+    alm_callback    *callback;
+    void            *arg;
+    int             has_stats;
+    alm_stats_t     stats;
+    alm_delay_t     miss_threshold;
+    unsigned long   misses;
+};
+
+struct alm_snap {
+    alm_stamp_t             now;
+    size_t                  num;
+    struct alm_snap_entry   entry[1];   /* actually num elements */
+};
+
+/* number of histogram buckets (log2 of time to due in microseconds) */
+#define SNAP_BUCKETS 40
+
+static size_t alm_queue_depth(void)
+{
+    alm_t next;
+    size_t depth = 0;
+
+    for (next = first_alm; next; next = next->next)
+        depth++;
+    return depth;
+}
+
+/* copy the state of one alarm */
+static void alm_snap_fill(struct alm_snap_entry *e, alm_t alm)
+{
+    e->alm = alm;
+    e->due = alm->time_due;
+    e->active = alm_load_relaxed(alm->active) && !alm_stale(alm);
+    e->enqueued = alm->enqueued;
+    e->next = alm->next;
+    e->priority = alm->priority;
+    e->callback = alm->callback;
+    e->arg = alm->arg;
+    e->has_stats = unchecked_alm_get_stats(alm, &e->stats) == 0;
+    e->miss_threshold = alm->miss_threshold;
+    e->misses = alm->misses;
+}
+
+/* print one alarm in the format of alm_dump_alm */
+static void alm_snap_print(struct alm_snap_entry *e)
+{
+    printf("%p:due="alm_fmt",%s,%s,next=%p\n",
+        e->alm, alm_fmt_arg(ticks_to_usec(e->due)),
+        e->active ? "active" : "inactive",
+        e->enqueued ? "enqueued" : "dequeued", e->next);
+    if (e->has_stats) {
+        printf("%p:starts=%lu, fires=%lu, cancels=%lu, latency_last=%lu, "
+            "latency_max=%lu, duration_last=%lu\n", e->alm, e->stats.starts,
+            e->stats.fires, e->stats.cancels,
+            (unsigned long)e->stats.latency_last,
+            (unsigned long)e->stats.latency_max,
+            (unsigned long)e->stats.duration_last);
+    }
+    if (e->miss_threshold) {
+        printf("%p:miss_threshold=%lu, misses=%lu\n", e->alm,
+            (unsigned long)ticks_to_usec(e->miss_threshold), e->misses);
+    }
+}
+
+void alm_dump_alm(alm_t alm)
+{
+    struct alm_snap_entry e;
+
+    if (!alm) {
+        printf("<NULL>\n");
+    } else {
+        alm_snap_fill(&e, alm);
+        alm_snap_print(&e);
+    }
+}
+
+/* take a snapshot of the queue, free with free() */
+static struct alm_snap *alm_snapshot(void)
+{
+    struct alm_snap *snap = 0;
+    size_t size = 0, depth;
+    alm_t next;
+
+    for (;;) {
+        alm_queue_enter();
+        depth = alm_queue_depth();
+        if (snap && depth <= size) {
+            break;                      /* still locked */
+        }
+        alm_queue_leave();
+        free(snap);
+        size = depth + depth / 4 + 1;   /* room for some growth */
+        snap = (struct alm_snap *) malloc(sizeof(struct alm_snap)
+            + (size - 1) * sizeof(struct alm_snap_entry));
+        if (!snap) {
+            return NULL;
+        }
+    }
+    snap->now = alm_now();
+    snap->num = 0;
+    for (next = first_alm; next; next = next->next) {
+        struct alm_snap_entry *e = &snap->entry[snap->num++];
+
+        alm_snap_fill(e, next);
+    }
+    alm_queue_leave();
+    return snap;
+}
+
+/* symbolic name of a callback, if available */
+static const char *alm_symbol(alm_callback *callback, char *buf, size_t len)
+{
+#ifdef __linux__
+    Dl_info info;
+
+    if (dladdr((void *)callback, &info) && info.dli_sname) {
+        return info.dli_sname;
+    }
+#endif
+    sprintf(buf, "%p", (void *)callback);
+    return buf;
+}
+
+/* time to due in microseconds (negative if overdue) */
+static long long alm_snap_in(struct alm_snap *snap, struct alm_snap_entry *e)
+{
+    return e->due >= snap->now ? (long long)ticks_to_usec(e->due - snap->now)
+        : -(long long)ticks_to_usec(snap->now - e->due);
+}
+
+static void alm_snap_text(struct alm_snap *snap)
+{
+    size_t n;
+
+    if (!snap->num) {
+        printf("empty\n");
+    }
+    for (n = 0; n < snap->num; n++) {
+        alm_snap_print(&snap->entry[n]);
+    }
+}
+
+static void alm_snap_verbose(struct alm_snap *snap)
+{
+    char buf[32];
+    size_t n;
+
+    if (!snap->num) {
+        printf("empty\n");
+    }
+    for (n = 0; n < snap->num; n++) {
+        struct alm_snap_entry *e = &snap->entry[n];
+
+        printf("%p:due="alm_fmt",in=%lldus,%s,prio=%d,cb=%s(%p)\n",
+            e->alm, alm_fmt_arg(ticks_to_usec(e->due)), alm_snap_in(snap, e),
+            e->active ? "active" : "inactive", e->priority,
+            alm_symbol(e->callback, buf, sizeof(buf)), e->arg);
+    }
+}
+
+static void alm_snap_json(struct alm_snap *snap)
+{
+    char buf[32];
+    size_t n;
+
+    printf("{\"now\":%llu,\"alarms\":[", ticks_to_usec(snap->now));
+    for (n = 0; n < snap->num; n++) {
+        struct alm_snap_entry *e = &snap->entry[n];
+
+        printf("%s\n{\"alm\":\"%p\",\"due\":%llu,\"in\":%lld,"
+            "\"active\":%s,\"priority\":%d,\"callback\":\"%s\","
+            "\"arg\":\"%p\"}",
+            n ? "," : "", e->alm, ticks_to_usec(e->due), alm_snap_in(snap, e),
+            e->active ? "true" : "false", e->priority,
+            alm_symbol(e->callback, buf, sizeof(buf)), e->arg);
+    }
+    printf("]}\n");
+}
+
+static void alm_snap_summary(struct alm_snap *snap)
+{
+    unsigned long hist[SNAP_BUCKETS + 1];
+    unsigned long active = 0, overdue = 0;
+    long long in, nearest = 0, farthest = 0;
+    size_t n;
+    int b;
+
+    memset(hist, 0, sizeof(hist));
+    for (n = 0; n < snap->num; n++) {
+        struct alm_snap_entry *e = &snap->entry[n];
+
+        if (!e->active) continue;
+        in = alm_snap_in(snap, e);
+        if (!active || in < nearest) nearest = in;
+        if (!active || in > farthest) farthest = in;
+        active++;
+        if (in < 0) {
+            overdue++;
+            continue;
+        }
+        for (b = 0; b < SNAP_BUCKETS && (in >> b) > 0; b++)
+            ;
+        hist[b]++;
+    }
+    printf("depth=%lu, active=%lu, overdue=%lu\n",
+        (unsigned long)snap->num, active, overdue);
+    if (!active) return;
+    printf("nearest=%lldus, farthest=%lldus\n", nearest, farthest);
+    for (b = 0; b <= SNAP_BUCKETS; b++) {
+        if (hist[b]) {
+            printf("  <%12lluus: %lu\n", 1ull << b, hist[b]);
+        }
+    }
+}
+
+void alm_dump_snapshot(const char *mode)
+{
+    struct alm_snap *snap;
+
+    if (init_state != ALM_INIT_OK) {
+        printf("not initialized or initialization failed\n");
+        return;
+    }
+    snap = alm_snapshot();
+    if (!snap) {
+        printf("ERROR: memory allocation failed!\n");
+        return;
+    }
+    if (!mode || !*mode || strcmp(mode, "text") == 0) {
+        alm_snap_text(snap);
+    } else if (strcmp(mode, "verbose") == 0) {
+        alm_snap_verbose(snap);
+    } else if (strcmp(mode, "json") == 0) {
+        alm_snap_json(snap);
+    } else if (strcmp(mode, "summary") == 0) {
+        alm_snap_summary(snap);
+    } else {
+        printf("usage: alm_dump_snapshot [text|verbose|json|summary]\n");
+    }
+    free(snap);
+}
+
+void alm_dump_queue(void)
+{
+    alm_dump_snapshot("text");
+}
+
+void alm_dump_stats(void)
+{
+    unsigned long fired = alm_stats.fired;
+    alm_stamp_t busy = alm_stats.busy;
+
+    printf("activations=%lu, fired=%lu\n", alm_stats.activations, fired);
+    printf("busy=%lu, max_busy=%lu\n",
+        (unsigned long)ticks_to_usec(busy),
+        (unsigned long)ticks_to_usec(alm_stats.max_busy));
+    if (fired) {
+        printf("busy_per_fired=%luns\n",
+            (unsigned long)(ticks_to_nsec(busy) / fired));
+    }
+    printf("latency_offset=%lu (%s), latency_last=%lu, latency_max=%lu\n",
+        (unsigned long)ticks_to_usec(alm_latency_offset),
+        !alm_latency_fixed ? "auto" : alm_latency_offset ? "fixed" : "off",
+        (unsigned long)ticks_to_usec(alm_latency.last),
+        (unsigned long)ticks_to_usec(alm_latency.max));
+    printf("spin_threshold=%lu, spins=%lu, spin_time=%lu\n",
+        (unsigned long)ticks_to_usec(alm_spin_threshold), alm_stats.spins,
+        (unsigned long)ticks_to_usec(alm_stats.spin_time));
+    if (alm_stats.spins) {
+        printf("spin_per_saved_int=%lu\n", (unsigned long)
+            ticks_to_usec(alm_stats.spin_time / alm_stats.spins));
+    }
+    printf("timer_arms=%lu, arms_avoided=%lu, arm_tolerance=%lu\n",
+        alm_stats.timer_arms, alm_stats.arms_avoided,
+        (unsigned long)ticks_to_usec(alm_arm_tolerance));
+    if (alm_stats.rescans) {
+        printf("rescans=%lu\n", alm_stats.rescans);
+    }
+    if (alm_stats.overruns) {
+        printf("overruns=%lu\n", alm_stats.overruns);
+    }
+    if (alm_stats.clock_steps) {
+        printf("clock_steps=%lu\n", alm_stats.clock_steps);
+    }
+    if (alm_budget_count || alm_budget_time
+            || alm_stats.deferred || alm_stats.shed) {
+        printf("budget_count=%lu, budget_time=%lu, deferred=%lu, shed=%lu\n",
+            alm_budget_count, (unsigned long)ticks_to_usec(alm_budget_time),
+            alm_stats.deferred, alm_stats.shed);
+    }
+    if (alm_stats.cb_queued) {
+        printf("callbacks=%lu, callback_requests=%lu\n",
+            alm_stats.cb_queued, alm_stats.cb_requests);
+    }
+    if (alm_stats.batch_queued) {
+        printf("batched=%lu, batch_calls=%lu\n",
+            alm_stats.batch_queued, alm_stats.batch_calls);
+    }
+    if (alm_stats.misses) {
+        printf("misses=%lu, miss_records_dropped=%lu\n",
+            alm_stats.misses, alm_stats.miss_dropped);
+    }
+}
+
+void alm_reset_stats(void)
+{
+    int key = epicsInterruptLock();
+
+    alm_stats.activations = 0;
+    alm_stats.fired = 0;
+    alm_stats.busy = 0;
+    alm_stats.max_busy = 0;
+    alm_stats.spins = 0;
+    alm_stats.spin_time = 0;
+    alm_stats.rescans = 0;
+    alm_stats.overruns = 0;
+    alm_stats.clock_steps = 0;
+    alm_stats.deferred = 0;
+    alm_stats.shed = 0;
+    alm_stats.cb_queued = 0;
+    alm_stats.cb_requests = 0;
+    alm_stats.batch_queued = 0;
+    alm_stats.batch_calls = 0;
+    alm_stats.timer_arms = 0;
+    alm_stats.arms_avoided = 0;
+    alm_stats.misses = 0;
+    alm_stats.miss_dropped = 0;
+    epicsInterruptUnlock(key);
+}
+
+void alm_print_stamp(void)
+{
+    alm_stamp_t time=alm_get_stamp();
+    printf(""alm_fmt"\n",dhi(time),dlo(time));
+}
+
+/*
+ * Test code follows
+ */
+
+#include <semaphore.h>
+
+static long min_error, max_error;
+
+#define ERROR_LIMIT 0x7fffffff
+
+void alm_test_sem(void *parm)
+{
+    unsigned delay = (unsigned)parm;
+    sem_t sem;
+    alm_t alm;
+    alm_stamp_t t1, t2;
+    long real_delay, error;
+
+    sem_init(&sem, 0, 0);
+    alm = alm_create_sem(&sem);
+    if (!alm) {
+        printf("ERROR: alarm creation failed!\n");
+        return;
+    }
+    t1 = alm_get_stamp();
+    alm_start(alm, delay);
+    printf("alm_start with delay=%u (time="alm_fmt")\n", 
+        delay, dhi(t1), dlo(t1));
+    sem_wait(&sem);
+    t2 = alm_get_stamp();
+    real_delay = t2 - t1;
+    error = (long long)real_delay - (long long)delay;
+    printf("done (time="alm_fmt", real_delay="alm_fmt", error=%ld)\n",
+        dhi(t2), dlo(t2), dhi(real_delay), dlo(real_delay), error);
+    min_error = min(min_error, error);
+    max_error = max(max_error, error);
+    alm_destroy(alm);
+    sem_destroy(&sem);
+}
+
+void alm_test_sem_many(unsigned delay, unsigned num)
+{
+    min_error = ERROR_LIMIT;
+    max_error = -ERROR_LIMIT;
+    while (num) {
+        epicsThreadCreate("athx", epicsThreadPriorityMedium,
+            epicsThreadGetStackSize(epicsThreadStackMedium),
+            alm_test_sem, (void*) (delay * num));
+        epicsThreadSleep(0.2);
+        num--;
+    }
+    epicsThreadSleep(2.0);
+    alm_dump_queue();
+    printf("error_range=[%ld..%ld]\n", min_error, max_error);
+}
+
+struct testdata {
+    alm_stamp_t start, stop, nom_delay;
+    alm_t alm;
+};
+
+static int counter;
+
+void test_cb(void *arg)
+{
+    struct testdata *x = (struct testdata *)arg;
+
+    x->stop = alm_get_stamp();
+    alm_decrement(counter);
+}
+
+void alm_test_cb(unsigned delay, unsigned num, int overlap, int verbose)
+{
+    unsigned n = num;
+    struct testdata *data = calloc(num, sizeof(struct testdata));
+    long min_latency = ERROR_LIMIT, max_latency = -ERROR_LIMIT;
+#ifdef __linux__
+    struct rusage ru_start, ru_stop;
+#endif
+
+    if (!data) {
+        printf("ERROR: memory allocation failed!\n");
+        return;
+    }
+    min_error = ERROR_LIMIT;
+    max_error = -ERROR_LIMIT;
+
+#ifdef __linux__
+    getrusage(RUSAGE_SELF, &ru_start);
+#endif
+    counter = num;
+    for (n = 0; n < num; n++) {
+        struct testdata *x = &data[n];
+        x->alm = alm_create(test_cb, x);
+        x->nom_delay = (((unsigned)rand() << 16) + (unsigned)rand()) % delay;
+        if (overlap) {
+            x->start = alm_get_stamp();
+            alm_start(x->alm, x->nom_delay);
+        }
+    }
+    if (!overlap) {
+        for (n = 0; n < num; n++) {
+            struct testdata *x = &data[n];
+            x->start = alm_get_stamp();
+            alm_start(x->alm, x->nom_delay);
+        }
+    }
+    while (alm_load_acquire(counter) > 0) {
+        epicsThreadSleep(1.0/60);
+        printf(".");fflush(stdout);
+    }
+    printf("\n");
+#ifdef __linux__
+    getrusage(RUSAGE_SELF, &ru_stop);
+    printf("page_faults: minor=%ld, major=%ld\n",
+        ru_stop.ru_minflt - ru_start.ru_minflt,
+        ru_stop.ru_majflt - ru_start.ru_majflt);
+#endif
+    for (n = 0; n < num; n++) {
+        struct testdata *x = &data[n];
+        alm_stamp_t real_delay = x->stop - x->start;
+        alm_stamp_t due = ticks_to_usec(x->alm->time_due);
+        long latency = (long long)x->stop - (long long)due;
+
+        if (verbose) {
+            printf("%03u:start="alm_fmt",due="alm_fmt",stop="alm_fmt"\n",
+                n, alm_fmt_arg(x->start), alm_fmt_arg(due),
+                alm_fmt_arg(x->stop));
+            printf("%03u:n_delay="alm_fmt",r_delay="alm_fmt",latency=%ld\n",
+                n, alm_fmt_arg(x->nom_delay), alm_fmt_arg(real_delay), latency);
+        }
+        min_latency = min(min_latency, latency);
+        max_latency = max(max_latency, latency);
+    }
+    printf("latency_range=[%ld..%ld]\n", min_latency, max_latency);
+    if (verbose) {
+        alm_dump_queue();
+    }
+    for (n = 0; n < num; n++) {
+        alm_destroy(data[n].alm);
+    }
+    free(data);
+}
+
+static void test_count_cb(void *arg)
+{
+    alm_decrement(counter);
+}
+
+#define TEST_DISPATCH_ROUNDS 10
+#define TEST_EVICT_SIZE (16*1024*1024)  /* larger than the last level cache */
+
+/*
+ * Open a counter of the cache misses of the calling thread (Linux
+ * only), return -1 if not available.
+ */
+static int test_miss_counter(void)
+{
+#ifdef __linux__
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+/*
+ * Walk the queue up to <stamp> like the interrupt handler does, but
+ * without firing, return the number of active alarms passed.
+ */
+static unsigned test_walk(alm_stamp_t stamp)
+{
+    struct alm_pos pos;
+    unsigned active = 0;
+
+    alm_pos_first(&pos, alm_index_off ? 0 : alm_index, stamp);
+    while (alm_pos_due(&pos, stamp)) {
+        if (alm_load_acquire(pos.alm->active)
+                && alm_load_stamp(pos.alm->time_due) <= stamp)
+            active++;
+        alm_pos_next(&pos);
+    }
+    return active;
+}
+
+/*
+ * Measure dispatcher cost per alarm: <num> alarms are started with
+ * the same delay so that they are all fired in a single activation.
+ * This is repeated 2*TEST_DISPATCH_ROUNDS times, alternately with the
+ * handler walking the queue by its links and using the expiry index
+ * (in the order list, index, index, list, ... to even out drift). The
+ * alarms are started in random order, so that the queue does not follow
+ * their addresses. Before they fire, the queue is walked once the same
+ * way by the test itself, with a cold cache, to measure the walk alone:
+ * its time and, where the kernel provides hardware counters (Linux perf
+ * events), its cache misses.
+ */
+void alm_test_dispatch(unsigned num)
+{
+    struct {
+        unsigned long       activations;
+        unsigned long       fired;
+        alm_stamp_t         busy;
+        unsigned long       walked;
+        alm_stamp_t         walk;
+        unsigned long long  misses;
+    } res[2];
+    unsigned n, r, mode, tmp;
+    unsigned seed = 1;
+    alm_t *alms = calloc(num, sizeof(alm_t));
+    unsigned *order = calloc(num, sizeof(unsigned));
+    char *evict = malloc(TEST_EVICT_SIZE);
+    unsigned long long misses = 0;
+    alm_stamp_t t1;
+    int fd;
+
+    if (!alms || !order || !evict) {
+        printf("ERROR: memory allocation failed!\n");
+        free(alms);
+        free(order);
+        free(evict);
+        return;
+    }
+    for (n = 0; n < num; n++) {
+        alms[n] = alm_create(test_count_cb, 0);
+        order[n] = n;
+    }
+    memset(res, 0, sizeof(res));
+    fd = test_miss_counter();
+    for (r = 0; r < 2 * TEST_DISPATCH_ROUNDS; r++) {
+        mode = (r ^ (r >> 1)) & 1;
+        for (n = num; n > 1; n--) {
+            seed = seed * 1103515245 + 12345;
+            tmp = order[n - 1];
+            order[n - 1] = order[(seed >> 8) % n];
+            order[(seed >> 8) % n] = tmp;
+        }
+        alm_index_off = !mode;
+        counter = num;
+        for (n = 0; n < num; n++) {
+            alm_start(alms[order[n]], 100000);
+        }
+        for (n = 0; n < TEST_EVICT_SIZE; n += 64) {
+            evict[n] = (char)n;
+        }
+        alm_queue_enter();
+#ifdef __linux__
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+        t1 = alm_now();
+        res[mode].walked += test_walk(t1 + usec_to_ticks(200000));
+        res[mode].walk += alm_now() - t1;
+#ifdef __linux__
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &misses, sizeof(misses)) != sizeof(misses))
+                misses = 0;
+        }
+#endif
+        alm_queue_leave();
+        res[mode].misses += misses;
+        for (n = 0; n < TEST_EVICT_SIZE; n += 64) {
+            evict[n] = (char)n;
+        }
+        alm_reset_stats();
+        while (alm_load_acquire(counter) > 0) {
+            epicsThreadSleep(1.0/60);
+        }
+        res[mode].activations += alm_stats.activations;
+        res[mode].fired += alm_stats.fired;
+        res[mode].busy += alm_stats.busy;
+    }
+    alm_index_off = 0;
+#ifdef __linux__
+    if (fd >= 0)
+        close(fd);
+#endif
+    for (mode = 0; mode < 2; mode++) {
+        printf("%s: walk_per_alarm=%luns, cache_misses_per_alarm=",
+            mode ? "index" : "list ", res[mode].walked ? (unsigned long)
+                (ticks_to_nsec(res[mode].walk) / res[mode].walked) : 0);
+        if (fd >= 0 && res[mode].walked) {
+            printf("%.2f", (double)res[mode].misses / res[mode].walked);
+        } else {
+            printf("n/a");
+        }
+        printf(", activations=%lu, fired=%lu, busy_per_fired=%luns\n",
+            res[mode].activations, res[mode].fired,
+            res[mode].fired ? (unsigned long)
+                (ticks_to_nsec(res[mode].busy) / res[mode].fired) : 0);
+    }
+    for (n = 0; n < num; n++) {
+        alm_destroy(alms[n]);
+    }
+    free(alms);
+    free(order);
+    free(evict);
+}
+
+/*
+ * Compare the cost of alm_start and alm_postpone for pushing back the
+ * deadlines of <num> watchdog alarms <count> times each, then check
+ * that every alarm fires exactly once.
+ */
+void alm_test_postpone(unsigned num, unsigned count)
+{
+    unsigned n, c;
+    alm_t *alms;
+    alm_stamp_t t1, t2, t3;
+
+    if (!num || !count) {
+        printf("usage: alm_test_postpone num count (both > 0)\n");
+        return;
+    }
+    alms = calloc(num, sizeof(alm_t));
+    if (!alms) {
+        printf("ERROR: memory allocation failed!\n");
+        return;
+    }
+    for (n = 0; n < num; n++) {
+        alms[n] = alm_create(test_count_cb, 0);
+    }
+    counter = num;
+    for (n = 0; n < num; n++) {
+        alm_start(alms[n], 1000000);
+    }
+    t1 = alm_get_stamp();
+    for (c = 0; c < count; c++) {
+        for (n = 0; n < num; n++) {
+            alm_start(alms[n], 1000000);
+        }
+    }
+    t2 = alm_get_stamp();
+    for (c = 0; c < count; c++) {
+        for (n = 0; n < num; n++) {
+            alm_postpone(alms[n], 1000000);
+        }
+    }
+    t3 = alm_get_stamp();
+    printf("start=%luns, postpone=%luns (per call, %u alarms queued)\n",
+        (unsigned long)((t2 - t1) * 1000 / (num * count)),
+        (unsigned long)((t3 - t2) * 1000 / (num * count)), num);
+    while (alm_load_acquire(counter) > 0) {
+        epicsThreadSleep(1.0/60);
+    }
+    epicsThreadSleep(0.1);
+    printf("fired=%u (expected %u)\n", num - counter, num);
+    for (n = 0; n < num; n++) {
+        alm_destroy(alms[n]);
+    }
+    free(alms);
+}
+
+static void test_seq_start_cb(void *arg)
+{
+    alm_sequence_start((alm_seq_t)arg, 1000);
+}
+
+/*
+ * Run a sequence of <num> steps, <interval> microseconds apart, <runs>
+ * times and print the achieved timing (see alm_sequence_dump). Then
+ * start it once more from an alarm callback and check that all steps
+ * fire.
+ */
+void alm_test_sequence(unsigned num, unsigned interval, unsigned runs)
+{
+    alm_seq_step_t *steps = calloc(num, sizeof(alm_seq_step_t));
+    alm_seq_t seq = 0;
+    alm_t alm;
+    unsigned n;
+
+    if (steps) {
+        for (n = 0; n < num; n++) {
+            steps[n].offset = (alm_delay_t)n * interval;
+            steps[n].callback = test_count_cb;
+        }
+        seq = alm_sequence_create(steps, num);
+    }
+    if (!seq) {
+        printf("ERROR: memory allocation failed!\n");
+        free(steps);
+        return;
+    }
+    for (n = 0; n < runs; n++) {
+        counter = num;
+        alm_sequence_start(seq, 1000);
+        while (alm_load_acquire(counter) > 0) {
+            epicsThreadSleep(1.0/60);
+        }
+    }
+    alm_sequence_dump(seq);
+
+    alm = alm_create(test_seq_start_cb, seq);
+    if (alm) {
+        counter = num;
+        alm_start(alm, 1000);
+        for (n = 0; n < 60 && alm_load_acquire(counter) > 0; n++) {
+            epicsThreadSleep(1.0/60 + (double)num * interval * 1e-6 / 60);
+        }
+        printf("started from callback: fired=%u (expected %u)\n",
+            num - alm_load_acquire(counter), num);
+        alm_destroy(alm);
+    }
+    alm_sequence_destroy(seq);
+    free(steps);
+}
+
+/*
+ * Sleep <count> times for <delay> microseconds, first with alm_sleep,
+ * then with epicsThreadSleep, and print average and maximum oversleep.
+ */
+static void test_sleep_thread(void *arg)
+{
+    alm_sleep((alm_delay_t)(size_t)arg);
+    alm_decrement(counter);
+}
+
+void alm_test_sleep(unsigned delay, unsigned count)
+{
+    unsigned n, pass;
+    alm_stamp_t t1, t2, late, sum, worst;
+    unsigned long before;
+
+    for (pass = 0; pass < 2; pass++) {
+        sum = worst = 0;
+        for (n = 0; n < count; n++) {
+            t1 = alm_get_stamp();
+            if (pass == 0) {
+                if (alm_sleep(delay)) {
+                    printf("ERROR: alm_sleep failed!\n");
+                    return;
+                }
+            } else {
+                epicsThreadSleep(delay * 1e-6);
+            }
+            t2 = alm_get_stamp();
+            late = t2 - t1 > delay ? t2 - t1 - delay : 0;
+            sum += late;
+            if (late > worst)
+                worst = late;
+        }
+        printf("%s: late avg=%luus, max=%luus\n",
+            pass == 0 ? "alm_sleep" : "epicsThreadSleep",
+            count ? (unsigned long)(sum / count) : 0ul,
+            (unsigned long)worst);
+    }
+
+    /* the alarm and event of an exiting thread are freed */
+    before = alm_load_acquire(alm_sleepers);
+    counter = 10;
+    for (n = 0; n < 10; n++) {
+        if (!epicsThreadCreate("almTestSleep", epicsThreadPriorityMedium,
+                epicsThreadGetStackSize(epicsThreadStackSmall),
+                test_sleep_thread, (void *)(size_t)delay)) {
+            alm_decrement(counter);
+        }
+    }
+    for (n = 0; n < 100 && alm_load_acquire(counter) > 0; n++) {
+        epicsThreadSleep(0.01 + delay * 1e-6);
+    }
+    epicsThreadSleep(0.1);              /* let them exit */
+    printf("threads exited: sleepers left=%lu (expected %lu)\n",
+        alm_load_acquire(alm_sleepers), before);
+}
+
+static void test_callback_cb(CALLBACK *pcb)
+{
+    int *done;
+
+    callbackGetUser(done, pcb);
+    (*done)++;
+}
+
+/*
+ * Start <num> callback alarms of the given <priority> with identical
+ * delay, wait until all callbacks have run, and print the number of
+ * callback requests that were needed.
+ */
+void alm_test_callback(unsigned num, int priority)
+{
+    CALLBACK *cbs = calloc(num, sizeof(CALLBACK));
+    alm_t *alms = calloc(num, sizeof(alm_t));
+    int *done = calloc(num, sizeof(int));
+    unsigned n, total, wait;
+
+    if (!cbs || !alms || !done) {
+        printf("ERROR: memory allocation failed!\n");
+        goto cleanup;
+    }
+    for (n = 0; n < num; n++) {
+        callbackSetCallback(test_callback_cb, &cbs[n]);
+        callbackSetUser(&done[n], &cbs[n]);
+        alms[n] = alm_create_callback(&cbs[n], priority);
+        if (!alms[n]) {
+            printf("ERROR: alm_create_callback failed!\n");
+            goto cleanup;
+        }
+    }
+    alm_reset_stats();
+    for (n = 0; n < num; n++) {
+        alm_start(alms[n], 100000);
+    }
+    for (wait = 0; wait < 120; wait++) {
+        epicsThreadSleep(1.0/60);
+        for (n = total = 0; n < num; n++) {
+            total += done[n];
+        }
+        if (total >= num) break;
+    }
+    printf("callbacks run=%u (expected %u)\n", total, num);
+    alm_dump_stats();
+cleanup:
+    for (n = 0; alms && n < num; n++) {
+        if (alms[n]) alm_destroy(alms[n]);
+    }
+    free(done);
+    free(alms);
+    free(cbs);
+}
+
+/*
+ * Start an alarm at wall clock time now + <delay> microseconds, then
+ * shift the wall clock as seen by this library by <step> microseconds
+ * (simulating a clock step), and print when the alarm fired relative to
+ * the start (expected: delay - step, or at once if that is negative).
+ * The step is detected by the worker thread within WALL_CHECK_PERIOD.
+ * Needs ALM_TEST_WALL (see Makefile).
+ */
+void alm_test_wall(unsigned delay, int step)
+{
+#ifdef ALM_TEST_WALL
+    struct testdata x;
+    alm_t alm = alm_create(test_cb, &x);
+    epicsTimeStamp ts;
+    alm_stamp_t wall;
+
+    if (!alm) {
+        printf("ERROR: memory allocation failed!\n");
+        return;
+    }
+    counter = 1;
+    x.stop = 0;
+    wall = alm_wall_now() + delay;
+    ts.secPastEpoch = (epicsUInt32)(wall / 1000000);
+    ts.nsec = (epicsUInt32)(wall % 1000000) * 1000;
+    x.start = alm_get_stamp();
+    alm_start_at_epics(alm, &ts);
+    alm_wall_skew += step;
+    while (!x.stop) {
+        epicsThreadSleep(1.0/60);
+    }
+    alm_wall_skew -= step;
+    printf("fired after %luus (expected %ldus)\n",
+        (unsigned long)(x.stop - x.start),
+        (long)delay - step > 0 ? (long)delay - step : 0L);
+    alm_destroy(alm);
+#else
+    printf("alm_test_wall: not available, build with ALM_TEST_WALL=YES\n");
+#endif
+}
+
+/* like test_count_cb, but takes about a microsecond */
+static void test_busy_cb(void *arg)
+{
+    alm_stamp_t until = alm_now() + usec_to_ticks(1);
+
+    while (alm_now() < until)
+        ;
+    alm_decrement(counter);
 }
 
-void unchecked_alm_destroy(alm_t alm)
+/*
+ * Start <num> low priority alarms (with callbacks taking about 1us)
+ * and one high (or, if <high> is 0, normal) priority alarm, all due at
+ * the same time, the latter started last. Print when it fired and the budget statistics. Use
+ * alm_set_budget before to limit the work done per activation.
+ */
+void alm_test_budget(unsigned num, int high)
 {
-    alm_cancel(alm);
-    if (alm->enqueued) {
-        assert(init_state == ALM_INIT_OK);
-        epicsMutexMustLock(alm_lock);
-        alm_remove(alm);
-        epicsMutexUnlock(alm_lock);
+    alm_t *alms = calloc(num, sizeof(alm_t));
+    struct testdata x;
+    alm_t alm = alm_create(test_cb, &x);
+    alm_stamp_t due;
+    unsigned n;
+
+    if (!alms || !alm) {
+        printf("ERROR: memory allocation failed!\n");
+        goto cleanup;
     }
-    assert(!alm->active);
-    assert(!alm->enqueued);
-    free(alm);
+    for (n = 0; n < num; n++) {
+        alms[n] = alm_create(test_busy_cb, 0);
+        alm_set_priority(alms[n], ALM_PRIO_LOW);
+    }
+    alm_set_priority(alm, high ? ALM_PRIO_HIGH : ALM_PRIO_NORMAL);
+    alm_reset_stats();
+    counter = num + 1;
+    x.stop = 0;
+    due = alm_now() + usec_to_ticks(100000);
+    for (n = 0; n < num; n++) {
+        alm_start_due(alms[n], due, 0);
+    }
+    alm_start_due(alm, due, 0);
+    while (alm_load_acquire(counter) > 0) {
+        epicsThreadSleep(1.0/60);
+    }
+    printf("%s priority alarm fired %luus after due time\n",
+        high ? "high" : "normal",
+        (unsigned long)(x.stop - ticks_to_usec(due)));
+    alm_dump_stats();
+cleanup:
+    for (n = 0; alms && n < num; n++) {
+        if (alms[n]) alm_destroy(alms[n]);
+    }
+    if (alm) alm_destroy(alm);
+    free(alms);
 }
 
-alm_init_state_t alm_init_state(void)
+static unsigned test_misses_hooked;
+
+static void test_miss_hook(const alm_miss_t *miss, void *user)
 {
-    return init_state;
+    if (test_misses_hooked++ < *(unsigned *)user) {
+        printf("miss: alm=%p, arg=%p, due="alm_fmt", late=%luus, misses=%lu\n",
+            miss->alm, miss->arg, alm_fmt_arg(miss->due),
+            (unsigned long)miss->late, miss->misses);
+    }
 }
 
-int alm_init(int intLevel)
+/*
+ * Test deadline miss detection: start <num> alarms (with callbacks taking
+ * about a microsecond each) with lateness threshold <threshold> for the
+ * same time, so that the later ones miss their deadline. Print the first
+ * few records passed to the miss hook and the counters.
+ */
+void alm_test_miss(unsigned num, alm_delay_t threshold)
 {
-    int key = epicsInterruptLock();                /* lock interrupts during init */
+    alm_t *alms = calloc(num, sizeof(alm_t));
+    unsigned n, missed = 0, shown = 5;
+    alm_stamp_t due;
 
-    if (init_state != ALM_NO_INIT) {
-        goto done;
+    if (!alms) {
+        printf("ERROR: memory allocation failed!\n");
+        return;
     }
-    init_state = ALM_INIT_FAILED;       /* assume init failes */
-    timer_init();
-    timer_set_int_level(intLevel);
-    alm_lock = epicsMutexCreate();
-    if (!alm_lock) {
-        errlogSevPrintf(errlogFatal,
-            "alm_init: semMCreate failed\n");
-        goto done;
+    for (n = 0; n < num; n++) {
+        alms[n] = alm_create(test_busy_cb, alms + n);
+        alm_set_miss_threshold(alms[n], threshold);
     }
-    if (timer_install_int_routine(alm_int_handler))
-    {
-        errlogSevPrintf(errlogFatal, "alm_init: devConnectInterrupt failed\n");
-	goto done;
+    alm_reset_stats();
+    test_misses_hooked = 0;
+    alm_set_miss_hook(test_miss_hook, &shown);
+    counter = num;
+    due = alm_now() + usec_to_ticks(100000);
+    for (n = 0; n < num; n++) {
+        alm_start_due(alms[n], due, 0);
     }
-    timer_enable();
-    alm_setup_alarm(alm_get_stamp() + MAX_WAIT, 0);
+    while (alm_load_acquire(counter) > 0) {
+        epicsThreadSleep(1.0/60);
+    }
+    epicsThreadSleep(0.1);              /* let the worker call the hook */
+    alm_set_miss_hook(0, 0);
+    for (n = 0; n < num; n++) {
+        if (alm_get_misses(alms[n]))
+            missed++;
+        alm_destroy(alms[n]);
+    }
+    printf("alarms missed=%u (of %u), hook called=%u\n",
+        missed, num, test_misses_hooked);
+    alm_dump_stats();
+    free(alms);
+}
 
-    init_state = ALM_INIT_OK;           /* success */
+/*
+ * Test alarm groups: start <num> members of a group, cancel the group
+ * and check that none fires; restart them and check that all fire.
+ * Cancel the group again and postpone the members, which must start
+ * them like alm_start since they are no longer running. Then compare destroying <num> queued alarms one by one with destroying a
+ * group of <num> queued members, and check that the worker has removed
+ * all of them from the queue.
+ */
+void alm_test_group(unsigned num)
+{
+    alm_group_t group = alm_group_create();
+    alm_t *alms = calloc(num, sizeof(alm_t));
+    alm_stamp_t t1, t2, t3;
+    alm_t alm;
+    unsigned n, left = 0;
 
-done:
-    epicsInterruptUnlock(key);
-    return init_state;
+    if (!group || !alms) {
+        printf("ERROR: memory allocation failed!\n");
+        free(group);
+        free(alms);
+        return;
+    }
+    for (n = 0; n < num; n++) {
+        alm_create_in(group, test_count_cb, 0);
+    }
+    counter = num;
+    for (alm = group->members; alm; alm = alm->group_next) {
+        alm_start(alm, 10000);
+    }
+    t1 = alm_now();
+    alm_group_cancel(group);
+    t2 = alm_now();
+    epicsThreadSleep(0.1);
+    printf("cancel: %luns, fired=%u (expected 0)\n",
+        (unsigned long)ticks_to_nsec(t2 - t1), num - counter);
+    for (alm = group->members; alm; alm = alm->group_next) {
+        alm_start(alm, 10000);
+    }
+    while (alm_load_acquire(counter) > 0) {
+        epicsThreadSleep(1.0/60);
+    }
+    printf("restarted: fired=%u (expected %u)\n", num - counter, num);
+    counter = num;
+    for (alm = group->members; alm; alm = alm->group_next) {
+        alm_start(alm, 10000);
+    }
+    alm_group_cancel(group);
+    for (alm = group->members; alm; alm = alm->group_next) {
+        alm_postpone(alm, 20000);
+    }
+    epicsThreadSleep(0.1);
+    printf("postponed after cancel: fired=%u (expected %u)\n",
+        num - counter, num);
+
+    /* destroy queued alarms: one by one vs. as a group */
+    for (n = 0; n < num; n++) {
+        alms[n] = alm_create(test_count_cb, 0);
+        alm_start(alms[n], 1000000 + n);
+    }
+    for (alm = group->members; alm; alm = alm->group_next) {
+        alm_start(alm, 1000000);
+    }
+    t1 = alm_now();
+    for (n = 0; n < num; n++) {
+        alm_destroy(alms[num - 1 - n]);
+    }
+    t2 = alm_now();
+    alm_group_destroy(group);
+    t3 = alm_now();
+    epicsThreadSleep(0.1);
+    alm_queue_enter();
+    for (alm = first_alm; alm; alm = alm->next) {
+        if (alm->callback == test_count_cb)
+            left++;
+    }
+    alm_queue_leave();
+    printf("destroy %u: one by one=%luus, group=%luus, "
+        "left in queue=%u (expected 0)\n", num,
+        (unsigned long)ticks_to_usec(t2 - t1),
+        (unsigned long)ticks_to_usec(t3 - t2), left);
+    free(alms);
 }
 
-void alm_dump_alm(alm_t alm)
+static int test_sync_in_cb;
+static unsigned long test_sync_fired;
+
+static void test_sync_cb(void *arg)
 {
-    if (!alm) {
-        printf("<NULL>\n");
-    } else {
-        printf("%p:due="alm_fmt",%s,%s,next=%p\n",
-            alm, alm_fmt_arg(alm->time_due),
-            alm->active ? "active" : "inactive",
-            alm->enqueued ? "enqueued" : "dequeued", alm->next);
+    alm_stamp_t until = alm_now() + usec_to_ticks(50);
+
+    alm_store_relaxed(test_sync_in_cb, 1);
+    while (alm_now() < until)
+        ;
+    if (arg) {
+        alm_cancel_sync(*(alm_t *)arg);     /* must not wait for itself */
     }
+    alm_increment(test_sync_fired);
+    alm_store_release(test_sync_in_cb, 0);
 }
 
-void alm_dump_queue(void)
+static void test_sync_nop(void *arg)
 {
-    alm_t next = first_alm;
+}
 
-    if (init_state != ALM_INIT_OK) {
-        printf("not initialized or initialization failed\n");
-        return;
-    }
-    epicsMutexMustLock(alm_lock);
-    if (!first_alm) {
-        printf("empty\n");
-    } else {
-        while (next) {
-            alm_dump_alm(next);
-            next = next->next;
-        }
-    }
-    epicsMutexUnlock(alm_lock);
+static void test_sync_batch_cb(void **args, size_t n)
+{
+    test_sync_cb(0);
 }
 
-void alm_print_stamp(void)
+static void test_sync_epics_cb(CALLBACK *pcb)
 {
-    alm_stamp_t time=alm_get_stamp();
-    printf(""alm_fmt"\n",dhi(time),dlo(time));
+    test_sync_cb(0);
+}
+
+static void test_sync_report(const char *kind, unsigned count,
+    unsigned violations)
+{
+    printf("%s: fired=%lu (of %u), called after return=%u (expected 0)\n",
+        kind, alm_load_relaxed(test_sync_fired), count, violations);
 }
 
 /*
- * Test code follows
+ * Start and cancel <alm> <count> times, return violations: the callback
+ * is running after return or starts within 100us after return.
  */
+static unsigned test_sync_run(alm_t alm, alm_t blocker, unsigned count)
+{
+    alm_stamp_t until;
+    unsigned long fired;
+    unsigned seed = 1, n, violations = 0;
 
-#include <semaphore.h>
-#include <epicsThread.h>
+    alm_store_relaxed(test_sync_fired, 0);
+    for (n = 0; n < count; n++) {
+        seed = seed * 1103515245 + 12345;
+        if (blocker)
+            alm_start(blocker, 20);
+        alm_start(alm, 20);
+        until = alm_now() + usec_to_ticks((seed >> 8) % 100);
+        while (alm_now() < until)
+            ;
+        alm_cancel_sync(alm);
+        fired = alm_load_acquire(test_sync_fired);
+        if (alm_load_acquire(test_sync_in_cb)) {
+            violations++;
+            continue;
+        }
+        epicsThreadSleep(0.0);
+        until = alm_now() + usec_to_ticks(100);
+        while (alm_now() < until)
+            ;
+        if (alm_load_acquire(test_sync_in_cb)
+                || alm_load_acquire(test_sync_fired) != fired)
+            violations++;
+    }
+    return violations;
+}
 
-static long min_error, max_error;
+/*
+ * Test alm_cancel_sync: <count> times start an alarm whose callback takes
+ * about 50us, wait a random time around its due time, cancel it with
+ * alm_cancel_sync and check that the callback is no longer running
+ * afterwards. This is done once with the callback called by the handler
+ * and once with it shed to the worker thread (the budget is set to one
+ * alarm per activation, taken by another alarm due at the same time),
+ * for a batch member and for an EPICS callback alarm. Then check that a
+ * periodic alarm can cancel itself from within its callback.
+ */
+void alm_test_cancel_sync(unsigned count)
+{
+    static CALLBACK pcb;
+    alm_t alm = alm_create(test_sync_cb, 0);
+    alm_t blocker = alm_create(test_sync_nop, 0);
+    alm_batch_t batch;
+    unsigned violations;
 
-#define ERROR_LIMIT 0x7fffffff
+    violations = test_sync_run(alm, 0, count);
+    test_sync_report("handler", count, violations);
+    alm_set_priority(alm, ALM_PRIO_LOW);
+    alm_set_budget(1, 0);
+    violations = test_sync_run(alm, blocker, count);
+    alm_set_budget(0, 0);
+    test_sync_report("worker", count, violations);
+    alm_destroy(blocker);
+    alm_destroy(alm);
 
-void alm_test_sem(void *parm)
+    batch = alm_batch_create(test_sync_batch_cb, 1);
+    if (batch) {
+        alm = alm_create_batch(batch, 0);
+        violations = test_sync_run(alm, 0, count);
+        test_sync_report("batch", count, violations);
+        alm_destroy(alm);
+        alm_batch_destroy(batch);
+    }
+
+    callbackSetCallback(test_sync_epics_cb, &pcb);
+    alm = alm_create_callback(&pcb, priorityHigh);
+    violations = test_sync_run(alm, 0, count);
+    test_sync_report("EPICS callback", count, violations);
+    alm_destroy(alm);
+
+    alm = alm_create(test_sync_cb, &alm);
+    alm_store_relaxed(test_sync_fired, 0);
+    alm_start_periodic(alm, 1000, 1000);
+    epicsThreadSleep(0.1);
+    printf("self cancel: fired=%lu (expected 1)\n",
+        alm_load_relaxed(test_sync_fired));
+    alm_destroy(alm);
+}
+
+/*
+ * Test alm_destroy: queue <num> alarms and destroy them, the last one
+ * first (the worst case for a queue scan). Print the average and maximum
+ * time per call and, after the worker has run, the number of them still
+ * in the queue.
+ */
+void alm_test_destroy(unsigned num)
 {
-    unsigned delay = (unsigned)parm;
-    sem_t sem;
+    alm_t *alms = calloc(num, sizeof(alm_t));
+    alm_stamp_t t1, t2, total = 0, max_time = 0;
     alm_t alm;
-    alm_stamp_t t1, t2;
-    long real_delay, error;
+    unsigned n, left = 0;
 
-    sem_init(&sem, 0, 0);
-    alm = alm_create_sem(&sem);
-    if (!alm) {
-        printf("ERROR: alarm creation failed!\n");
+    if (!alms) {
+        printf("ERROR: memory allocation failed!\n");
         return;
     }
-    t1 = alm_get_stamp();
-    alm_start(alm, delay);
-    printf("alm_start with delay=%u (time="alm_fmt")\n", 
-        delay, dhi(t1), dlo(t1));
-    sem_wait(&sem);
-    t2 = alm_get_stamp();
-    real_delay = t2 - t1;
-    error = (long long)real_delay - (long long)delay;
-    printf("done (time="alm_fmt", real_delay="alm_fmt", error=%ld)\n",
-        dhi(t2), dlo(t2), dhi(real_delay), dlo(real_delay), error);
-    min_error = min(min_error, error);
-    max_error = max(max_error, error);
-    alm_destroy(alm);
-    sem_destroy(&sem);
+    for (n = 0; n < num; n++) {
+        alms[n] = alm_create(test_count_cb, 0);
+        alm_start(alms[n], 1000000 + n);
+    }
+    for (n = num; n > 0; n--) {
+        t1 = alm_now();
+        alm_destroy(alms[n - 1]);
+        t2 = alm_now();
+        total += t2 - t1;
+        if (t2 - t1 > max_time)
+            max_time = t2 - t1;
+    }
+    epicsThreadSleep(0.1);
+    alm_queue_enter();
+    for (alm = first_alm; alm; alm = alm->next) {
+        if (alm->callback == test_count_cb)
+            left++;
+    }
+    alm_queue_leave();
+    printf("destroy %u: avg=%luns, max=%luns, left in queue=%u "
+        "(expected 0)\n", num,
+        (unsigned long)(num ? ticks_to_nsec(total) / num : 0),
+        (unsigned long)ticks_to_nsec(max_time), left);
+    free(alms);
 }
 
-void alm_test_sem_many(unsigned delay, unsigned num)
+static unsigned long test_batch_calls;
+static int test_batch_unordered;
+
+static void test_batch_cb(void **args, size_t n)
 {
-    min_error = ERROR_LIMIT;
-    max_error = -ERROR_LIMIT;
-    while (num) {
-        epicsThreadCreate("athx", epicsThreadPriorityMedium,
-            epicsThreadGetStackSize(epicsThreadStackMedium),
-            alm_test_sem, (void*) (delay * num));
-        epicsThreadSleep(0.2);
-        num--;
+    size_t i;
+
+    for (i = 1; i < n; i++) {
+        if ((size_t)args[i] < (size_t)args[i - 1])
+            test_batch_unordered++;
     }
-    epicsThreadSleep(2.0);
-    alm_dump_queue();
-    printf("error_range=[%ld..%ld]\n", min_error, max_error);
+    test_batch_calls++;
+    alm_store_release(counter, counter - (int)n);
 }
 
-struct testdata {
-    alm_stamp_t start, stop, nom_delay;
-    alm_t alm;
+/*
+ * Test batches: start <num> ordinary alarms due at the same time and
+ * print the handler's busy time per alarm, then the same for <num>
+ * members of a batch with capacity <num>/4 + 1, and how often the batch
+ * callback was called (expected 4 times, with args in order of
+ * expiration). Also check that the batch cannot be destroyed while it
+ * still has members.
+ */
+void alm_test_batch(unsigned num)
+{
+    alm_batch_t batch = alm_batch_create(test_batch_cb, num / 4 + 1);
+    alm_t *alms = calloc(num, sizeof(alm_t));
+    alm_stamp_t due;
+    unsigned n, pass;
+
+    if (!batch || !alms) {
+        printf("ERROR: memory allocation failed!\n");
+        free(batch);
+        free(alms);
+        return;
+    }
+    for (pass = 0; pass < 2; pass++) {
+        for (n = 0; n < num; n++) {
+            alms[n] = pass ? alm_create_batch(batch, (void *)(size_t)n)
+                : alm_create(test_count_cb, 0);
+        }
+        test_batch_calls = 0;
+        test_batch_unordered = 0;
+        counter = num;
+        alm_reset_stats();
+        due = alm_now() + usec_to_ticks(1000000);
+        for (n = 0; n < num; n++) {
+            alm_start_due(alms[n], due, 0);
+        }
+        while (alm_load_acquire(counter) > 0) {
+            epicsThreadSleep(1.0/60);
+        }
+        epicsThreadSleep(0.01);         /* let the activation finish */
+        printf("%s: busy_per_alarm=%luns", pass ? "batch" : "single",
+            (unsigned long)(ticks_to_nsec(alm_stats.busy) / num));
+        if (pass) {
+            printf(", batch_calls=%lu, unordered=%d",
+                test_batch_calls, test_batch_unordered);
+            printf(", destroy with members=%d (expected -1)",
+                alm_batch_destroy(batch));
+        }
+        printf("\n");
+        for (n = 0; n < num; n++) {
+            alm_destroy(alms[n]);
+        }
+    }
+    alm_batch_destroy(batch);
+    free(alms);
+}
+
+/*
+ * Stress test for concurrent use: <threads> tasks each own <num> alarms
+ * and start, postpone, cancel and destroy/re-create them at random with
+ * short delays for <seconds>, while the main task checks that the queue
+ * stays sorted. Finally all alarms are started once more and it is
+ * checked that each of them fires.
+ */
+struct stress_task {
+    unsigned        num;
+    alm_t           *alms;
+    int             *fired;
+    unsigned long   ops;
+    volatile int    stop;
+    epicsEventId    done;
 };
 
-static int counter;
+static void test_stress_cb(void *arg)
+{
+    int *fired = (int *)arg;
 
-void test_cb(void *arg)
+    alm_store_relaxed(*fired, alm_load_relaxed(*fired) + 1);
+}
+
+static void test_stress_task(void *arg)
 {
-    struct testdata *x = (struct testdata *)arg;
+    struct stress_task *t = (struct stress_task *)arg;
+    unsigned seed = (unsigned)(size_t)t;
+    unsigned n;
 
-    x->stop = alm_get_stamp();
-    counter--;
+    while (!alm_load_relaxed(t->stop)) {
+        seed = seed * 1103515245 + 12345;
+        n = (seed >> 8) % t->num;
+        switch ((seed >> 20) % 8) {
+        case 0:
+            alm_cancel(t->alms[n]);
+            break;
+        case 1:
+            alm_postpone(t->alms[n], (seed >> 4) % 200);
+            break;
+        case 2:
+            alm_destroy(t->alms[n]);
+            t->alms[n] = alm_create(test_stress_cb, &t->fired[n]);
+            break;
+        default:
+            alm_start(t->alms[n], (seed >> 4) % 200);
+            break;
+        }
+        t->ops++;
+    }
+    epicsEventSignal(t->done);
 }
 
-void alm_test_cb(unsigned delay, unsigned num, int overlap, int verbose)
+/*
+ * Check that the queue is sorted and that the expiry index matches its
+ * head, return number of errors.
+ */
+static unsigned alm_check_queue(void)
 {
-    unsigned n = num;
-    struct testdata *data = calloc(num, sizeof(struct testdata));
-    long min_latency = ERROR_LIMIT, max_latency = -ERROR_LIMIT;
+    alm_t next;
+    unsigned errors = 0, n = 0;
 
-    if (!data) {
-        printf("ERROR: memory allocation failed!\n");
-        return;
+    alm_queue_enter();
+    for (next = first_alm; next && next->next; next = next->next) {
+        if (next->time_due > next->next->time_due)
+            errors++;
     }
-    min_error = ERROR_LIMIT;
-    max_error = -ERROR_LIMIT;
+    for (next = first_alm; next && n < ALM_INDEX_SIZE; next = next->next, n++) {
+        if (n >= alm_index->count || alm_index->alm[n] != next
+                || alm_index->due[n] != next->time_due)
+            errors++;
+    }
+    if (n != alm_index->count)
+        errors++;
+    alm_queue_leave();
+    return errors;
+}
 
-    counter = num;
-    for (n = 0; n < num; n++) {
-        struct testdata *x = &data[n];
-        x->alm = alm_create(test_cb, x);
-        x->nom_delay = (((unsigned)rand() << 16) + (unsigned)rand()) % delay;
-        if (overlap) {
-            x->start = alm_get_stamp();
-            alm_start(x->alm, x->nom_delay);
-        }
+void alm_test_stress(unsigned threads, unsigned num, unsigned seconds)
+{
+    struct stress_task *tasks = calloc(threads, sizeof(struct stress_task));
+    unsigned t, n, errors = 0, missing = 0, checks = 0;
+    unsigned long ops = 0;
+    alm_stamp_t until;
+
+    if (!tasks || !num) {
+        printf("ERROR: memory allocation failed!\n");
+        free(tasks);
+        return;
     }
-    if (!overlap) {
+    alm_reset_stats();
+    for (t = 0; t < threads; t++) {
+        tasks[t].num = num;
+        tasks[t].alms = calloc(num, sizeof(alm_t));
+        tasks[t].fired = calloc(num, sizeof(int));
+        tasks[t].done = epicsEventMustCreate(epicsEventEmpty);
         for (n = 0; n < num; n++) {
-            struct testdata *x = &data[n];
-            x->start = alm_get_stamp();
-            alm_start(x->alm, x->nom_delay);
+            tasks[t].alms[n] = alm_create(test_stress_cb, &tasks[t].fired[n]);
         }
+        epicsThreadMustCreate("almStress", epicsThreadPriorityMedium,
+            epicsThreadGetStackSize(epicsThreadStackSmall),
+            test_stress_task, &tasks[t]);
     }
-    while (counter > 0) {
-        epicsThreadSleep(1.0/60);
-        printf(".");fflush(stdout);
+    until = alm_get_stamp() + (alm_stamp_t)seconds * 1000000;
+    while (alm_get_stamp() < until) {
+        errors += alm_check_queue();
+        checks++;
+        epicsThreadSleep(0.01);
     }
-    printf("\n");
-    for (n = 0; n < num; n++) {
-        struct testdata *x = &data[n];
-        alm_stamp_t real_delay = x->stop - x->start;
-        long latency = (long long)x->stop - (long long)x->alm->time_due;
-
-        if (verbose) {
-            printf("%03u:start="alm_fmt",due="alm_fmt",stop="alm_fmt"\n",
-                n, alm_fmt_arg(x->start),
-                alm_fmt_arg(x->alm->time_due),
-                alm_fmt_arg(x->stop));
-            printf("%03u:n_delay="alm_fmt",r_delay="alm_fmt",latency=%ld\n",
-                n, alm_fmt_arg(x->nom_delay), alm_fmt_arg(real_delay), latency);
-        }
-        min_latency = min(min_latency, latency);
-        max_latency = max(max_latency, latency);
+    for (t = 0; t < threads; t++) {
+        alm_store_relaxed(tasks[t].stop, 1);
+        epicsEventMustWait(tasks[t].done);
+        ops += tasks[t].ops;
     }
-    printf("latency_range=[%ld..%ld]\n", min_latency, max_latency);
-    if (verbose) {
-        alm_dump_queue();
+    /* every alarm must fire exactly once after a final start */
+    for (t = 0; t < threads; t++) {
+        for (n = 0; n < num; n++) {
+            alm_store_relaxed(tasks[t].fired[n], 0);
+            alm_start(tasks[t].alms[n], 1000);
+        }
     }
-    for (n = 0; n < num; n++) {
-        alm_destroy(data[n].alm);
+    epicsThreadSleep(0.1);
+    for (t = 0; t < threads; t++) {
+        for (n = 0; n < num; n++) {
+            if (alm_load_relaxed(tasks[t].fired[n]) != 1)
+                missing++;
+            alm_destroy(tasks[t].alms[n]);
+        }
+        epicsEventDestroy(tasks[t].done);
+        free(tasks[t].alms);
+        free(tasks[t].fired);
     }
-    free(data);
+    free(tasks);
+    printf("ops=%lu (%lu/s), queue checks=%u, unsorted=%u, not fired once=%u\n",
+        ops, ops / (seconds ? seconds : 1), checks, errors, missing);
+    alm_dump_stats();
 }
 
 void alm_test_create_event(int delay)
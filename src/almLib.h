@@ -32,8 +32,12 @@ along with alarm.  If not, see <https://www.gnu.org/licenses/>.
 extern "C" {
 #endif
 
+#include <stddef.h>
+
 #include <DbC.h>
 #include <epicsEvent.h>
+#include <epicsTime.h>
+#include <callback.h>
 
 /* type of timestamps (in microseconds) */
 typedef unsigned long long alm_stamp_t;
@@ -61,6 +65,21 @@ typedef void alm_callback(void*);
  */
 typedef struct alm_def *alm_t;
 
+/*
+ * Storage for an alarm object that lives in caller provided memory
+ * (see alm_init_static). Its size and alignment are sufficient for the
+ * private alarm structure; the contents must not be accessed directly.
+ */
+#define ALM_STORAGE_WORDS 24
+
+typedef struct {
+    union {
+        void        *ptr;
+        alm_stamp_t stamp;
+        double      dbl;
+    } opaque[ALM_STORAGE_WORDS];
+} alm_storage_t;
+
 typedef enum {
     ALM_INIT_OK=0,
     ALM_INIT_FAILED=-1,
@@ -78,6 +97,32 @@ typedef enum {
  */
 extern alm_init_state_t alm_init(int intLevel);
 
+/* flags for alm_init_ex */
+#define ALM_INIT_RT     0x1     /* lock and prefault memory (Linux) */
+#define ALM_INIT_CALIBRATE 0x2  /* measure latency offset, see alm_calibrate */
+#define ALM_INIT_RT_HEAP 0x4    /* with ALM_INIT_RT: tune malloc (Linux) */
+
+/*
+ * Like alm_init, with additional <flags>. With ALM_INIT_RT, all memory of
+ * the process is locked (mlockall, current and future mappings) and the
+ * stack of the worker thread is prefaulted, so that firing an alarm does
+ * not take a page fault. Locking needs CAP_IPC_LOCK or a sufficient
+ * RLIMIT_MEMLOCK; if it fails, memory is only prefaulted.
+ *
+ * ALM_INIT_RT_HEAP (only together with ALM_INIT_RT) additionally
+ * prefaults a heap reserve, so that creating an alarm after init does
+ * not take a page fault either. To keep the reserve, it changes the
+ * malloc settings of the whole process with mallopt: freed memory is
+ * never returned to the system (M_TRIM_THRESHOLD) and large blocks are
+ * no longer mmap'ed (M_MMAP_MAX). This affects every allocation in the
+ * IOC, not only those of this library: the heap only grows and stays at
+ * its peak size. Both flags have no effect on the other targets.
+ * With ALM_INIT_CALIBRATE, alm_init_ex calls alm_calibrate before it
+ * returns, i.e. it blocks for a few milliseconds, and enables latency
+ * compensation with the measured offset (see alm_set_latency_offset).
+ */
+extern alm_init_state_t alm_init_ex(int intLevel, unsigned flags);
+
 /*
  * Return the current init state.
  */
@@ -86,9 +131,131 @@ extern alm_init_state_t alm_init_state(void);
 /*
  * Create a new alarm. Whenever this alarm expires, <callback> will be
  * called with <arg> as argument. Returns NULL if allocation failes.
+ *
+ * Callbacks run in the interrupt handler. They may start (alm_start,
+ * alm_start_periodic, alm_start_at_epics, alm_postpone,
+ * alm_sequence_start), cancel and destroy alarms, including their own.
+ * A start from a callback is handed over to the worker thread, so it
+ * takes effect with the worker's latency. On Linux, callbacks run in the
+ * dispatcher thread with the interrupt lock held, a single process-wide
+ * mutex there: every epicsInterruptLock in the IOC waits while they run,
+ * so keep them short.
  */
 extern alm_t alm_create(alm_callback *callback, void *arg);
 
+/* flags for alm_create_ex */
+#define ALM_CREATE_STATS    0x1     /* keep per-alarm statistics */
+
+/*
+ * Like alm_create, with additional <flags>. With ALM_CREATE_STATS, the
+ * alarm keeps counters that can be read with alm_get_stats. Alarms
+ * created without it need no extra memory or time.
+ */
+extern alm_t alm_create_ex(alm_callback *callback, void *arg, unsigned flags);
+
+/*
+ * Per-alarm statistics, see alm_create_ex. Latencies are measured from
+ * the due time to the call of the callback, all times in microseconds.
+ */
+typedef struct {
+    unsigned long   starts;
+    unsigned long   fires;
+    unsigned long   cancels;
+    alm_delay_t     latency_last;
+    alm_delay_t     latency_max;
+    alm_delay_t     duration_last;  /* of the callback */
+} alm_stats_t;
+
+/*
+ * Copy the statistics of <alm> to <stats>. Returns 0 on success, -1 if
+ * the alarm was created without ALM_CREATE_STATS.
+ */
+extern int unchecked_alm_get_stats(alm_t alm, alm_stats_t *stats);
+
+#define alm_get_stats(alm, stats)\
+    assertPre((alm) != NULL && (stats) != NULL,\
+        alm_get_stats(alm, stats))
+
+/*
+ * Alarm groups. An alarm created in a group behaves like any other, but
+ * all members can be cancelled with a single call that takes constant
+ * time, regardless of the number of members (e.g. all timeouts of a
+ * device that has disconnected). Cancelled members are removed from the
+ * queue lazily. Members can be started again after the group has been
+ * cancelled and destroyed individually with alm_destroy.
+ */
+typedef struct alm_group_def *alm_group_t;
+
+/* Create an empty group. Returns NULL if allocation failes. */
+extern alm_group_t alm_group_create(void);
+
+/* Create a new alarm (see alm_create) as member of <group>. */
+extern alm_t unchecked_alm_create_in(alm_group_t group,
+    alm_callback *callback, void *arg);
+
+#define alm_create_in(group, callback, arg)\
+    assertPre((group) != NULL && alm_init_state() == ALM_INIT_OK,\
+        alm_create_in(group, callback, arg))
+
+/* Cancel all alarms of <group> (like alm_cancel). */
+extern void unchecked_alm_group_cancel(alm_group_t group);
+
+#define alm_group_cancel(group)\
+    assertPre((group) != NULL,\
+        alm_group_cancel(group))
+
+/*
+ * Destroy <group> together with all its members. Like alm_destroy, this
+ * does not wait: the worker thread removes the members in a single pass
+ * over the queue and frees them (and then the group) once the interrupt
+ * handler can no longer see them. The group and member handles must no
+ * longer be used.
+ */
+extern void unchecked_alm_group_destroy(alm_group_t group);
+
+#define alm_group_destroy(group)\
+    assertPre((group) != NULL && alm_init_state() == ALM_INIT_OK,\
+        alm_group_destroy(group))
+
+/*
+ * Batches. Alarms created with alm_create_batch share the callback of
+ * their batch: instead of calling it once per alarm, the interrupt
+ * handler collects the <arg>s of all members that expire in one
+ * activation and calls it once with an array of <n> of them, in order
+ * of expiration (e.g. many per-channel timeouts that expire together
+ * after a network stall). At most <capacity> args are passed per call;
+ * if more members expire, the callback is called more than once.
+ * The callback is only ever called by the interrupt handler, never by
+ * two threads at once: members are not shed to the worker thread (see
+ * alm_set_budget), once the budget is used up they are deferred to the
+ * next activation like normal priority alarms.
+ */
+typedef struct alm_batch_def *alm_batch_t;
+
+typedef void alm_batch_callback(void **args, size_t n);
+
+/* Create a batch. Returns NULL if allocation fails or capacity is 0. */
+extern alm_batch_t alm_batch_create(alm_batch_callback *callback,
+    size_t capacity);
+
+/* Create a new alarm as member of <batch>, see above. */
+extern alm_t unchecked_alm_create_batch(alm_batch_t batch, void *arg);
+
+#define alm_create_batch(batch, arg)\
+    assertPre((batch) != NULL && alm_init_state() == ALM_INIT_OK,\
+        alm_create_batch(batch, arg))
+
+/*
+ * Destroy <batch>. Returns -1 (and leaves the batch alone) if not all
+ * its members have been destroyed (with alm_destroy), else waits until
+ * the batch callback is no longer running and returns 0.
+ */
+extern int unchecked_alm_batch_destroy(alm_batch_t batch);
+
+#define alm_batch_destroy(batch)\
+    assertPre((batch) != NULL && alm_init_state() == ALM_INIT_OK,\
+        alm_batch_destroy(batch))
+
 /*
  * Create a new alarm that gives a semaphore on expiration.
  */
@@ -99,9 +266,31 @@ extern alm_t alm_create(alm_callback *callback, void *arg);
  */
 extern alm_t alm_create_event(epicsEventId ev);
 
+/*
+ * Create a new alarm that runs the EPICS callback <pcb> with the given
+ * callback <priority> (priorityLow, priorityMedium or priorityHigh) on
+ * expiration. The priority field of <pcb> is ignored. All such alarms
+ * that expire in one activation of the interrupt handler are passed
+ * to the callback task of their priority in a single callbackRequest.
+ * If the alarm expires again before its callback has run, the callback
+ * runs only once. Returns NULL if allocation fails or the priority is
+ * invalid. Use alm_destroy to delete the alarm.
+ */
+extern alm_t unchecked_alm_create_callback(CALLBACK *pcb, int priority);
+
+#define alm_create_callback(pcb, priority)\
+    assertPre((pcb) != NULL && (pcb)->callback != NULL\
+        && alm_init_state() == ALM_INIT_OK,\
+        alm_create_callback(pcb, priority))
+
 /*
  * Destroy an alarm object. The alarm object handle that was given as
- * argument must no longer be used.
+ * argument must no longer be used. This neither blocks nor scans the
+ * queue (it may be called from callbacks): the alarm is cancelled and
+ * handed over to the worker thread, which frees it once the interrupt
+ * handler can no longer be looking at it. A callback already running
+ * may still be executing on return; use alm_cancel_sync before if its
+ * argument is to be freed.
  */
 extern void unchecked_alm_destroy(alm_t alm);
 
@@ -109,11 +298,32 @@ extern void unchecked_alm_destroy(alm_t alm);
     assertPre((alm) != NULL && alm_init_state() == ALM_INIT_OK,\
         alm_destroy(alm))
 
+/*
+ * Initialize an alarm object in caller provided <storage>, e.g. embedded
+ * in a driver's per-channel structure. No memory is allocated. Otherwise
+ * the alarm behaves exactly like one returned by alm_create. Returns the
+ * handle to be used with all other routines.
+ */
+extern alm_t alm_init_static(alm_storage_t *storage,
+    alm_callback *callback, void *arg);
+
+/*
+ * Finalize an alarm object initialized with alm_init_static. The alarm
+ * is cancelled and removed from the queue; afterwards the storage may be
+ * reused or freed by the caller. Do not use alm_destroy on such objects.
+ */
+extern void unchecked_alm_fini_static(alm_t alm);
+
+#define alm_fini_static(alm)\
+    assertPre((alm) != NULL && alm_init_state() == ALM_INIT_OK,\
+        alm_fini_static(alm))
+
 #define MAX_DELAY 0x8000000000000000ull
 
 /*
  * Start alarm clock for the given alarm object <alm>. The object's callback
- * will be called (from interrupt handler) after <delay> microseconds.
+ * will be called (from interrupt handler) after <delay> microseconds. It
+ * sees everything the calling task has written before alm_start.
  *
  * Delays greater than MAX_DELAY (microseconds) are silently
  * ignored. They would be /a lot/ further into the future than
@@ -125,6 +335,80 @@ extern void unchecked_alm_start(alm_t alm, alm_delay_t delay);
     assertPre((alm) != NULL && alm_init_state() == ALM_INIT_OK,\
         alm_start(alm, delay))
 
+/*
+ * Start a periodic alarm: the callback is called first after <delay>
+ * microseconds, then every <period> microseconds. Each deadline is
+ * computed from the previous one, so there is no drift. Periods that
+ * are missed completely (e.g. because the handler was blocked) are
+ * skipped and counted as overruns (see alm_dump_stats). alm_cancel,
+ * alm_start and alm_destroy stop the alarm.
+ *
+ * After each expiration the interrupt handler re-files the alarm with
+ * its next deadline before it returns, unless a task holds the queue at
+ * that moment (e.g. in alm_start or alm_cancel): then the worker thread
+ * re-files it, like a postponed alarm. An expiration that falls due
+ * before the worker has done so is delayed until it has (the following
+ * deadlines are not affected), so under heavy queue traffic from tasks
+ * the worker's wake-up latency (see alm_set_worker_priority) still
+ * matters for periods that short.
+ */
+extern void unchecked_alm_start_periodic(alm_t alm, alm_delay_t delay,
+    alm_delay_t period);
+
+#define alm_start_periodic(alm, delay, period)\
+    assertPre((alm) != NULL && alm_init_state() == ALM_INIT_OK,\
+        alm_start_periodic(alm, delay, period))
+
+/*
+ * Start alarm clock for the given alarm object <alm> so that it expires
+ * at the wall clock time <ts>. Relative alarms (alm_start etc.) are not
+ * affected if the wall clock is set or stepped (e.g. by NTP), whereas
+ * alarms started with this routine are re-scheduled according to the
+ * new wall clock time (checked once per second). Times in the past
+ * expire immediately.
+ */
+extern void unchecked_alm_start_at_epics(alm_t alm, const epicsTimeStamp *ts);
+
+#define alm_start_at_epics(alm, ts)\
+    assertPre((alm) != NULL && (ts) != NULL\
+        && alm_init_state() == ALM_INIT_OK,\
+        alm_start_at_epics(alm, ts))
+
+/*
+ * Push back the deadline of a running alarm to <delay> microseconds
+ * from now (watchdog pattern). If the alarm is running and the new
+ * deadline is not earlier than the current one, only the new deadline
+ * is recorded, which costs O(1) and does not take the queue lock; when
+ * the old deadline expires, the alarm is re-filed instead of fired.
+ * Otherwise this is equivalent to alm_start.
+ */
+extern void unchecked_alm_postpone(alm_t alm, alm_delay_t delay);
+
+#define alm_postpone(alm, delay)\
+    assertPre((alm) != NULL && alm_init_state() == ALM_INIT_OK,\
+        alm_postpone(alm, delay))
+
+/*
+ * Suspend the calling thread for <delay> microseconds, or until the
+ * time <stamp> (as returned by alm_get_stamp). The thread is woken by
+ * the alarm interrupt handler. The alarm and event used for this are
+ * allocated on first use per thread and then reused, so that repeated
+ * calls (e.g. in a loop) allocate nothing; they are released when the
+ * thread exits (epicsAtThreadExit). Must not be called from interrupt
+ * context. Return 0 on success, -1 if allocation failed or the time is
+ * out of range.
+ */
+extern int unchecked_alm_sleep(alm_delay_t delay);
+extern int unchecked_alm_sleep_until(alm_stamp_t stamp);
+
+#define alm_sleep(delay)\
+    assertPre(alm_init_state() == ALM_INIT_OK,\
+        alm_sleep(delay))
+
+#define alm_sleep_until(stamp)\
+    assertPre(alm_init_state() == ALM_INIT_OK,\
+        alm_sleep_until(stamp))
+
 /* Cancel an outstanding alarm */
 extern void unchecked_alm_cancel(alm_t alm);
 
@@ -132,6 +416,199 @@ extern void unchecked_alm_cancel(alm_t alm);
     assertPre((alm) != NULL,\
         alm_cancel(alm))
 
+/*
+ * Cancel an alarm and wait until its callback is not running. After
+ * return, the callback will not be called unless the alarm is started
+ * again, so that its argument may be freed. Waiting is only necessary
+ * if the callback is executing concurrently (Linux, or callbacks run by
+ * the worker thread, see alm_set_budget); otherwise this is as cheap as
+ * alm_cancel. If called from the alarm's own callback, it does not wait.
+ * Must not be called from interrupt level. This also covers the batch
+ * callback of alarms created with alm_create_batch (it waits until the
+ * arg has been passed) and the EPICS callback of alarms created with
+ * alm_create_callback (a queued request is dropped, a running one is
+ * waited for).
+ */
+extern void unchecked_alm_cancel_sync(alm_t alm);
+
+#define alm_cancel_sync(alm)\
+    assertPre((alm) != NULL && alm_init_state() == ALM_INIT_OK,\
+        alm_cancel_sync(alm))
+
+/*
+ * Type of alarm sequences: a fixed set of steps that fire at given
+ * offsets (in microseconds) relative to a common start time.
+ */
+typedef struct alm_seq_def *alm_seq_t;
+
+typedef struct {
+    alm_delay_t     offset;
+    alm_callback    *callback;
+    void            *arg;
+} alm_seq_step_t;
+
+/*
+ * Create a sequence from an array of <num> steps. The steps are copied
+ * (and sorted by offset), the array may be reused afterwards. Returns
+ * NULL if allocation fails.
+ */
+extern alm_seq_t alm_sequence_create(const alm_seq_step_t *steps,
+    unsigned num);
+
+/*
+ * Start a sequence: step i fires at start + offset_i, where start is
+ * <delay> microseconds from now. All deadlines are absolute, so errors
+ * do not accumulate from step to step. Restarting a running sequence
+ * cancels the remaining steps of the previous run.
+ *
+ * From a callback, the steps are handed over to the worker thread like
+ * any start (see alm_create), so steps due before it has run fire late.
+ */
+extern void unchecked_alm_sequence_start(alm_seq_t seq, alm_delay_t delay);
+
+#define alm_sequence_start(seq, delay)\
+    assertPre((seq) != NULL && alm_init_state() == ALM_INIT_OK,\
+        alm_sequence_start(seq, delay))
+
+/* Cancel the outstanding steps of a sequence */
+extern void unchecked_alm_sequence_cancel(alm_seq_t seq);
+
+#define alm_sequence_cancel(seq)\
+    assertPre((seq) != NULL,\
+        alm_sequence_cancel(seq))
+
+/* Destroy a sequence. The handle must no longer be used. */
+extern void unchecked_alm_sequence_destroy(alm_seq_t seq);
+
+#define alm_sequence_destroy(seq)\
+    assertPre((seq) != NULL && alm_init_state() == ALM_INIT_OK,\
+        alm_sequence_destroy(seq))
+
+/*
+ * Print the timing of the last run of a sequence: for each step its
+ * offset, the error of the actual fire time relative to the start time,
+ * and the maximum deviation of the interval to the previous step from
+ * its nominal value over all runs (inter-step jitter).
+ */
+extern void alm_sequence_dump(alm_seq_t seq);
+
+/*
+ * Priority classes. Due alarms of priority ALM_PRIO_HIGH are fired
+ * before all others and are not subject to the budget. When the budget
+ * of an activation is used up, due alarms of priority ALM_PRIO_NORMAL
+ * (the default) are deferred to the next activation, and those of
+ * priority ALM_PRIO_LOW are shed to the worker thread, i.e. their
+ * callbacks are then called from task context. Batch members (see
+ * alm_create_batch) are deferred even if their priority is low.
+ */
+typedef enum {
+    ALM_PRIO_HIGH,
+    ALM_PRIO_NORMAL,
+    ALM_PRIO_LOW
+} alm_priority_t;
+
+extern void unchecked_alm_set_priority(alm_t alm, alm_priority_t priority);
+
+#define alm_set_priority(alm, priority)\
+    assertPre((alm) != NULL && (priority) >= ALM_PRIO_HIGH\
+        && (priority) <= ALM_PRIO_LOW,\
+        alm_set_priority(alm, priority))
+
+/*
+ * Deadline miss detection. If a lateness threshold (in microseconds, 0
+ * means off, the default) is set for an alarm, the interrupt handler
+ * compares the time the callback is called with the due time. If it is
+ * later by more than the threshold, the miss is counted for the alarm
+ * (see alm_get_misses) and globally (see alm_dump_stats), and a record
+ * is passed to the miss hook, if one is set. The hook is called by the
+ * worker thread, i.e. in task context, with the library's lock held:
+ * the alarm stays valid during the call, but the hook must not block.
+ * Records are dropped (and counted) if the worker falls behind.
+ */
+typedef struct {
+    alm_t           alm;            /* NULL if destroyed meanwhile */
+    alm_callback    *callback;
+    void            *arg;
+    alm_stamp_t     due;            /* due time (microseconds) */
+    alm_delay_t     late;           /* lateness (microseconds) */
+    unsigned long   misses;         /* misses of the alarm so far */
+} alm_miss_t;
+
+typedef void alm_miss_hook(const alm_miss_t *miss, void *user);
+
+extern void unchecked_alm_set_miss_threshold(alm_t alm, alm_delay_t threshold);
+
+#define alm_set_miss_threshold(alm, threshold)\
+    assertPre((alm) != NULL,\
+        alm_set_miss_threshold(alm, threshold))
+
+extern unsigned long unchecked_alm_get_misses(alm_t alm);
+
+#define alm_get_misses(alm)\
+    assertPre((alm) != NULL,\
+        alm_get_misses(alm))
+
+extern void alm_set_miss_hook(alm_miss_hook *hook, void *user);
+
+/*
+ * Limit the number of callbacks (<count>) and/or the time spent
+ * (<time>, in microseconds) per activation of the interrupt handler
+ * for alarms of normal and low priority; 0 means unlimited (default).
+ * <count> may be at most 100000 and <time> at most 1000000 (one second);
+ * otherwise a usage message is printed and the budget is unchanged.
+ * The numbers of deferred and shed alarms are shown by alm_dump_stats.
+ */
+extern void alm_set_budget(unsigned long count, alm_delay_t time);
+
+/*
+ * Set the spin threshold (in microseconds, default 0). If the next alarm
+ * is due within this time when the interrupt handler is about to return,
+ * the handler busy-waits for it instead of setting up the timer and taking
+ * another interrupt. Trades CPU time at interrupt level for latency; see
+ * alm_dump_stats for the time spent spinning. Values above 1000 are
+ * rejected (with a message) and leave the threshold unchanged.
+ */
+extern void alm_set_spin_threshold(alm_delay_t threshold);
+
+/*
+ * Set the EPICS priority of the worker thread, which re-files postponed
+ * alarms, runs shed callbacks and miss hooks and frees destroyed alarms.
+ * The default is one below epicsThreadPriorityScanHigh, so that the
+ * worker does not preempt the scan threads. May be called before or after
+ * alm_init; values above epicsThreadPriorityMax are rejected.
+ */
+extern void alm_set_worker_priority(unsigned priority);
+
+/*
+ * Set the arm tolerance (in microseconds, default 0). Starting an alarm
+ * does not set up the timer again if it is already armed to expire at
+ * most this much later than the new alarm requires; the alarm may then
+ * fire late by up to the tolerance. Saves a timer_settime system call
+ * per alm_start on Linux. alm_dump_stats shows how many timer set ups
+ * were made and avoided. Values above 1000 are rejected (with a message)
+ * and leave the tolerance unchanged.
+ */
+extern void alm_set_arm_tolerance(alm_delay_t tolerance);
+
+/*
+ * Latency compensation: the timer is set up early by the latency
+ * offset (in microseconds) and the interrupt handler spins for the
+ * remaining time, so that alarms fire close to their due time. It is
+ * off by default (offset 0). A non-negative <offset> fixes the offset,
+ * a negative one makes it track the latency measured by every
+ * activation of the handler (which spins for the tracked offset, so a
+ * latency outlier costs CPU time until the average has decayed). The
+ * current value is printed by alm_dump_stats.
+ */
+extern void alm_set_latency_offset(long offset);
+
+/*
+ * Measure the interrupt latency with <num> short alarms and set the
+ * latency offset to the result (tracking, if enabled, continues from
+ * there). Must not be called from interrupt context.
+ */
+extern void alm_calibrate(unsigned num);
+
 /* Return the current timestamp. This routine may be called from interrupt
    context. */
 extern alm_stamp_t alm_get_stamp(void);
@@ -139,8 +616,31 @@ extern alm_stamp_t alm_get_stamp(void);
 /* Test routines */
 extern void alm_dump_alm(alm_t alm);
 extern void alm_dump_queue(void);
+/*
+ * Print a snapshot of the queue; <mode> is "text" (default, the format of
+ * alm_dump_queue), "verbose" (time to due, priority, callback and arg per
+ * alarm), "json" or "summary" (depth, nearest and farthest due, histogram
+ * of times to due). The queue lock is only held while copying, not during
+ * output.
+ */
+extern void alm_dump_snapshot(const char *mode);
+extern void alm_dump_stats(void);
+extern void alm_reset_stats(void);
 extern void alm_print_stamp(void);
 extern void alm_test_cb(unsigned delay, unsigned num, int overlap, int verbose);
+extern void alm_test_dispatch(unsigned num);
+extern void alm_test_postpone(unsigned num, unsigned count);
+extern void alm_test_sequence(unsigned num, unsigned interval, unsigned runs);
+extern void alm_test_sleep(unsigned delay, unsigned count);
+extern void alm_test_callback(unsigned num, int priority);
+extern void alm_test_wall(unsigned delay, int step);
+extern void alm_test_budget(unsigned num, int high);
+extern void alm_test_miss(unsigned num, alm_delay_t threshold);
+extern void alm_test_group(unsigned num);
+extern void alm_test_cancel_sync(unsigned count);
+extern void alm_test_destroy(unsigned num);
+extern void alm_test_batch(unsigned num);
+extern void alm_test_stress(unsigned threads, unsigned num, unsigned seconds);
 extern void alm_test_create_event(int delay);
 
 #ifdef __cplusplus
@@ -27,6 +27,9 @@ along with alarm.  If not, see <https://www.gnu.org/licenses/>.
 #include <epicsExport.h>
 #include <iocsh.h>
 #include "almLib.h"
+#include "almScan.h"
+#include "timer.h"
+#include "timer_conv.h"
 
 static const iocshArg alm_initArg0 = {"interrupt level",iocshArgInt};
 static const iocshArg *alm_initArgs[] = {&alm_initArg0};
@@ -36,6 +39,15 @@ static void alm_initCallFunc(const iocshArgBuf *args)
     alm_init(args[0].ival);
 }
 
+static const iocshArg alm_init_exArg0 = {"interrupt level",iocshArgInt};
+static const iocshArg alm_init_exArg1 = {"flags",iocshArgInt};
+static const iocshArg *alm_init_exArgs[] = {&alm_init_exArg0,&alm_init_exArg1};
+static const iocshFuncDef alm_init_exFuncDef = {"alm_init_ex",2,alm_init_exArgs};
+static void alm_init_exCallFunc(const iocshArgBuf *args)
+{
+    alm_init_ex(args[0].ival, args[1].ival);
+}
+
 static const iocshArg alm_test_cbArg0 = {"delay",iocshArgInt};
 static const iocshArg alm_test_cbArg1 = {"num",iocshArgInt};
 static const iocshArg alm_test_cbArg2 = {"overlap",iocshArgInt};
@@ -47,13 +59,282 @@ static void alm_test_cbCallFunc(const iocshArgBuf *args)
     alm_test_cb(args[0].ival, args[1].ival, args[2].ival, args[3].ival);
 }
 
+static const iocshFuncDef alm_dump_statsFuncDef = {"alm_dump_stats",0,NULL};
+static void alm_dump_statsCallFunc(const iocshArgBuf *args)
+{
+    alm_dump_stats();
+}
+
+static const iocshFuncDef alm_reset_statsFuncDef = {"alm_reset_stats",0,NULL};
+static void alm_reset_statsCallFunc(const iocshArgBuf *args)
+{
+    alm_reset_stats();
+}
+
+static const iocshArg alm_set_arm_toleranceArg0 = {"tolerance",iocshArgInt};
+static const iocshArg *alm_set_arm_toleranceArgs[1] = {&alm_set_arm_toleranceArg0};
+static const iocshFuncDef alm_set_arm_toleranceFuncDef = {"alm_set_arm_tolerance",1,alm_set_arm_toleranceArgs};
+static void alm_set_arm_toleranceCallFunc(const iocshArgBuf *args)
+{
+    alm_set_arm_tolerance(args[0].ival);
+}
+
+static const iocshArg alm_set_spin_thresholdArg0 = {"threshold",iocshArgInt};
+static const iocshArg *alm_set_spin_thresholdArgs[1] = {&alm_set_spin_thresholdArg0};
+static const iocshFuncDef alm_set_spin_thresholdFuncDef = {"alm_set_spin_threshold",1,alm_set_spin_thresholdArgs};
+static void alm_set_spin_thresholdCallFunc(const iocshArgBuf *args)
+{
+    alm_set_spin_threshold(args[0].ival);
+}
+
+static const iocshArg alm_set_worker_priorityArg0 = {"priority",iocshArgInt};
+static const iocshArg *alm_set_worker_priorityArgs[1] = {&alm_set_worker_priorityArg0};
+static const iocshFuncDef alm_set_worker_priorityFuncDef = {"alm_set_worker_priority",1,alm_set_worker_priorityArgs};
+static void alm_set_worker_priorityCallFunc(const iocshArgBuf *args)
+{
+    alm_set_worker_priority(args[0].ival);
+}
+
+static const iocshArg alm_set_latency_offsetArg0 = {"offset",iocshArgInt};
+static const iocshArg *alm_set_latency_offsetArgs[1] = {&alm_set_latency_offsetArg0};
+static const iocshFuncDef alm_set_latency_offsetFuncDef = {"alm_set_latency_offset",1,alm_set_latency_offsetArgs};
+static void alm_set_latency_offsetCallFunc(const iocshArgBuf *args)
+{
+    alm_set_latency_offset(args[0].ival);
+}
+
+static const iocshArg alm_calibrateArg0 = {"num",iocshArgInt};
+static const iocshArg *alm_calibrateArgs[1] = {&alm_calibrateArg0};
+static const iocshFuncDef alm_calibrateFuncDef = {"alm_calibrate",1,alm_calibrateArgs};
+static void alm_calibrateCallFunc(const iocshArgBuf *args)
+{
+    alm_calibrate(args[0].ival);
+}
+
+static const iocshArg alm_test_dispatchArg0 = {"num",iocshArgInt};
+static const iocshArg *alm_test_dispatchArgs[1] = {&alm_test_dispatchArg0};
+static const iocshFuncDef alm_test_dispatchFuncDef = {"alm_test_dispatch",1,alm_test_dispatchArgs};
+static void alm_test_dispatchCallFunc(const iocshArgBuf *args)
+{
+    alm_test_dispatch(args[0].ival);
+}
+
+static const iocshArg alm_test_postponeArg0 = {"num",iocshArgInt};
+static const iocshArg alm_test_postponeArg1 = {"count",iocshArgInt};
+static const iocshArg *alm_test_postponeArgs[2] = {&alm_test_postponeArg0,&alm_test_postponeArg1};
+static const iocshFuncDef alm_test_postponeFuncDef = {"alm_test_postpone",2,alm_test_postponeArgs};
+static void alm_test_postponeCallFunc(const iocshArgBuf *args)
+{
+    alm_test_postpone(args[0].ival, args[1].ival);
+}
+
+static const iocshArg alm_test_sequenceArg0 = {"num",iocshArgInt};
+static const iocshArg alm_test_sequenceArg1 = {"interval",iocshArgInt};
+static const iocshArg alm_test_sequenceArg2 = {"runs",iocshArgInt};
+static const iocshArg *alm_test_sequenceArgs[3] = {&alm_test_sequenceArg0,&alm_test_sequenceArg1,&alm_test_sequenceArg2};
+static const iocshFuncDef alm_test_sequenceFuncDef = {"alm_test_sequence",3,alm_test_sequenceArgs};
+static void alm_test_sequenceCallFunc(const iocshArgBuf *args)
+{
+    alm_test_sequence(args[0].ival, args[1].ival, args[2].ival);
+}
+
+static const iocshArg alm_test_sleepArg0 = {"delay",iocshArgInt};
+static const iocshArg alm_test_sleepArg1 = {"count",iocshArgInt};
+static const iocshArg *alm_test_sleepArgs[2] = {&alm_test_sleepArg0,&alm_test_sleepArg1};
+static const iocshFuncDef alm_test_sleepFuncDef = {"alm_test_sleep",2,alm_test_sleepArgs};
+static void alm_test_sleepCallFunc(const iocshArgBuf *args)
+{
+    alm_test_sleep(args[0].ival, args[1].ival);
+}
+
+static const iocshArg alm_test_callbackArg0 = {"num",iocshArgInt};
+static const iocshArg alm_test_callbackArg1 = {"priority",iocshArgInt};
+static const iocshArg *alm_test_callbackArgs[2] = {&alm_test_callbackArg0,&alm_test_callbackArg1};
+static const iocshFuncDef alm_test_callbackFuncDef = {"alm_test_callback",2,alm_test_callbackArgs};
+static void alm_test_callbackCallFunc(const iocshArgBuf *args)
+{
+    alm_test_callback(args[0].ival, args[1].ival);
+}
+
+static const iocshArg alm_test_wallArg0 = {"delay",iocshArgInt};
+static const iocshArg alm_test_wallArg1 = {"step",iocshArgInt};
+static const iocshArg *alm_test_wallArgs[2] = {&alm_test_wallArg0,&alm_test_wallArg1};
+static const iocshFuncDef alm_test_wallFuncDef = {"alm_test_wall",2,alm_test_wallArgs};
+static void alm_test_wallCallFunc(const iocshArgBuf *args)
+{
+    alm_test_wall(args[0].ival, args[1].ival);
+}
+
+static const iocshArg alm_set_budgetArg0 = {"count",iocshArgInt};
+static const iocshArg alm_set_budgetArg1 = {"time",iocshArgInt};
+static const iocshArg *alm_set_budgetArgs[2] = {&alm_set_budgetArg0,&alm_set_budgetArg1};
+static const iocshFuncDef alm_set_budgetFuncDef = {"alm_set_budget",2,alm_set_budgetArgs};
+static void alm_set_budgetCallFunc(const iocshArgBuf *args)
+{
+    alm_set_budget(args[0].ival, args[1].ival);
+}
+
+static const iocshArg alm_test_missArg0 = {"num",iocshArgInt};
+static const iocshArg alm_test_missArg1 = {"threshold",iocshArgInt};
+static const iocshArg *alm_test_missArgs[2] = {&alm_test_missArg0,&alm_test_missArg1};
+static const iocshFuncDef alm_test_missFuncDef = {"alm_test_miss",2,alm_test_missArgs};
+static void alm_test_missCallFunc(const iocshArgBuf *args)
+{
+    alm_test_miss(args[0].ival, args[1].ival);
+}
+
+static const iocshArg alm_test_groupArg0 = {"num",iocshArgInt};
+static const iocshArg *alm_test_groupArgs[1] = {&alm_test_groupArg0};
+static const iocshFuncDef alm_test_groupFuncDef = {"alm_test_group",1,alm_test_groupArgs};
+static void alm_test_groupCallFunc(const iocshArgBuf *args)
+{
+    alm_test_group(args[0].ival);
+}
+
+static const iocshArg alm_test_cancel_syncArg0 = {"count",iocshArgInt};
+static const iocshArg *alm_test_cancel_syncArgs[1] = {&alm_test_cancel_syncArg0};
+static const iocshFuncDef alm_test_cancel_syncFuncDef = {"alm_test_cancel_sync",1,alm_test_cancel_syncArgs};
+static void alm_test_cancel_syncCallFunc(const iocshArgBuf *args)
+{
+    alm_test_cancel_sync(args[0].ival);
+}
+
+static const iocshArg alm_test_destroyArg0 = {"num",iocshArgInt};
+static const iocshArg *alm_test_destroyArgs[1] = {&alm_test_destroyArg0};
+static const iocshFuncDef alm_test_destroyFuncDef = {"alm_test_destroy",1,alm_test_destroyArgs};
+static void alm_test_destroyCallFunc(const iocshArgBuf *args)
+{
+    alm_test_destroy(args[0].ival);
+}
+
+static const iocshArg alm_test_batchArg0 = {"num",iocshArgInt};
+static const iocshArg *alm_test_batchArgs[1] = {&alm_test_batchArg0};
+static const iocshFuncDef alm_test_batchFuncDef = {"alm_test_batch",1,alm_test_batchArgs};
+static void alm_test_batchCallFunc(const iocshArgBuf *args)
+{
+    alm_test_batch(args[0].ival);
+}
+
+static const iocshArg alm_test_budgetArg0 = {"num",iocshArgInt};
+static const iocshArg alm_test_budgetArg1 = {"high",iocshArgInt};
+static const iocshArg *alm_test_budgetArgs[2] = {&alm_test_budgetArg0,&alm_test_budgetArg1};
+static const iocshFuncDef alm_test_budgetFuncDef = {"alm_test_budget",2,alm_test_budgetArgs};
+static void alm_test_budgetCallFunc(const iocshArgBuf *args)
+{
+    alm_test_budget(args[0].ival, args[1].ival);
+}
+
+static const iocshArg alm_dump_snapshotArg0 = {"mode",iocshArgString};
+static const iocshArg *alm_dump_snapshotArgs[1] = {&alm_dump_snapshotArg0};
+static const iocshFuncDef alm_dump_snapshotFuncDef = {"alm_dump_snapshot",1,alm_dump_snapshotArgs};
+static void alm_dump_snapshotCallFunc(const iocshArgBuf *args)
+{
+    alm_dump_snapshot(args[0].sval);
+}
+
+static const iocshArg alm_test_stressArg0 = {"threads",iocshArgInt};
+static const iocshArg alm_test_stressArg1 = {"num",iocshArgInt};
+static const iocshArg alm_test_stressArg2 = {"seconds",iocshArgInt};
+static const iocshArg *alm_test_stressArgs[3] = {&alm_test_stressArg0,&alm_test_stressArg1,&alm_test_stressArg2};
+static const iocshFuncDef alm_test_stressFuncDef = {"alm_test_stress",3,alm_test_stressArgs};
+static void alm_test_stressCallFunc(const iocshArgBuf *args)
+{
+    alm_test_stress(args[0].ival, args[1].ival, args[2].ival);
+}
+
+static const iocshArg almScanPeriodArg0 = {"name",iocshArgString};
+static const iocshArg almScanPeriodArg1 = {"period",iocshArgInt};
+static const iocshArg *almScanPeriodArgs[2] = {&almScanPeriodArg0,&almScanPeriodArg1};
+static const iocshFuncDef almScanPeriodFuncDef = {"almScanPeriod",2,almScanPeriodArgs};
+static void almScanPeriodCallFunc(const iocshArgBuf *args)
+{
+    almScanPeriod(args[0].sval, args[1].ival);
+}
+
+static const iocshArg almScanReportArg0 = {"name",iocshArgString};
+static const iocshArg *almScanReportArgs[1] = {&almScanReportArg0};
+static const iocshFuncDef almScanReportFuncDef = {"almScanReport",1,almScanReportArgs};
+static void almScanReportCallFunc(const iocshArgBuf *args)
+{
+    almScanReport(args[0].sval);
+}
+
+static const iocshArg almScanTestArg0 = {"period",iocshArgInt};
+static const iocshArg almScanTestArg1 = {"count",iocshArgInt};
+static const iocshArg *almScanTestArgs[2] = {&almScanTestArg0,&almScanTestArg1};
+static const iocshFuncDef almScanTestFuncDef = {"almScanTest",2,almScanTestArgs};
+static void almScanTestCallFunc(const iocshArgBuf *args)
+{
+    almScanTest(args[0].ival, args[1].ival);
+}
+
+static const iocshArg timer_conv_testArg0 = {"divisor",iocshArgInt};
+static const iocshArg timer_conv_testArg1 = {"exhaustive",iocshArgInt};
+static const iocshArg *timer_conv_testArgs[2] = {&timer_conv_testArg0,&timer_conv_testArg1};
+static const iocshFuncDef timer_conv_testFuncDef = {"timer_conv_test",2,timer_conv_testArgs};
+static void timer_conv_testCallFunc(const iocshArgBuf *args)
+{
+    timer_conv_test(args[0].ival, args[1].ival);
+}
+
+#ifdef __linux__
+static const iocshArg timer_poll_modeArg0 = {"enable",iocshArgInt};
+static const iocshArg timer_poll_modeArg1 = {"cpu",iocshArgInt};
+static const iocshArg timer_poll_modeArg2 = {"priority",iocshArgInt};
+static const iocshArg *timer_poll_modeArgs[3] = {&timer_poll_modeArg0,&timer_poll_modeArg1,&timer_poll_modeArg2};
+static const iocshFuncDef timer_poll_modeFuncDef = {"timer_poll_mode",3,timer_poll_modeArgs};
+static void timer_poll_modeCallFunc(const iocshArgBuf *args)
+{
+    timer_poll_mode(args[0].ival, args[1].ival, args[2].ival);
+}
+
+static const iocshArg timer_poll_reportArg0 = {"reset",iocshArgInt};
+static const iocshArg *timer_poll_reportArgs[1] = {&timer_poll_reportArg0};
+static const iocshFuncDef timer_poll_reportFuncDef = {"timer_poll_report",1,timer_poll_reportArgs};
+static void timer_poll_reportCallFunc(const iocshArgBuf *args)
+{
+    timer_poll_report(args[0].ival);
+}
+#endif
+
 static void almRegisterCommands(void)
 {
     static int firstTime = 1;
     if (firstTime) {
         firstTime = 0;
         iocshRegister(&alm_initFuncDef,alm_initCallFunc);
+        iocshRegister(&alm_init_exFuncDef,alm_init_exCallFunc);
         iocshRegister(&alm_test_cbFuncDef,alm_test_cbCallFunc);
+        iocshRegister(&alm_dump_statsFuncDef,alm_dump_statsCallFunc);
+        iocshRegister(&alm_reset_statsFuncDef,alm_reset_statsCallFunc);
+        iocshRegister(&alm_set_spin_thresholdFuncDef,alm_set_spin_thresholdCallFunc);
+        iocshRegister(&alm_set_arm_toleranceFuncDef,alm_set_arm_toleranceCallFunc);
+        iocshRegister(&alm_set_worker_priorityFuncDef,alm_set_worker_priorityCallFunc);
+        iocshRegister(&alm_set_latency_offsetFuncDef,alm_set_latency_offsetCallFunc);
+        iocshRegister(&alm_calibrateFuncDef,alm_calibrateCallFunc);
+        iocshRegister(&alm_test_dispatchFuncDef,alm_test_dispatchCallFunc);
+        iocshRegister(&alm_test_postponeFuncDef,alm_test_postponeCallFunc);
+        iocshRegister(&alm_test_sequenceFuncDef,alm_test_sequenceCallFunc);
+        iocshRegister(&alm_test_sleepFuncDef,alm_test_sleepCallFunc);
+        iocshRegister(&alm_test_callbackFuncDef,alm_test_callbackCallFunc);
+        iocshRegister(&alm_test_wallFuncDef,alm_test_wallCallFunc);
+        iocshRegister(&alm_set_budgetFuncDef,alm_set_budgetCallFunc);
+        iocshRegister(&alm_test_budgetFuncDef,alm_test_budgetCallFunc);
+        iocshRegister(&alm_test_missFuncDef,alm_test_missCallFunc);
+        iocshRegister(&alm_test_groupFuncDef,alm_test_groupCallFunc);
+        iocshRegister(&alm_test_cancel_syncFuncDef,alm_test_cancel_syncCallFunc);
+        iocshRegister(&alm_test_destroyFuncDef,alm_test_destroyCallFunc);
+        iocshRegister(&alm_test_batchFuncDef,alm_test_batchCallFunc);
+        iocshRegister(&alm_dump_snapshotFuncDef,alm_dump_snapshotCallFunc);
+        iocshRegister(&alm_test_stressFuncDef,alm_test_stressCallFunc);
+        iocshRegister(&almScanPeriodFuncDef,almScanPeriodCallFunc);
+        iocshRegister(&almScanReportFuncDef,almScanReportCallFunc);
+        iocshRegister(&almScanTestFuncDef,almScanTestCallFunc);
+        iocshRegister(&timer_conv_testFuncDef,timer_conv_testCallFunc);
+#ifdef __linux__
+        iocshRegister(&timer_poll_modeFuncDef,timer_poll_modeCallFunc);
+        iocshRegister(&timer_poll_reportFuncDef,timer_poll_reportCallFunc);
+#endif
     }
 }
 epicsExportRegistrar(almRegisterCommands);
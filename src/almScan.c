@@ -0,0 +1,384 @@
+/*==========================================================
+                             alarm
+  ==========================================================
+
+Copyright 2022 Helmholtz-Zentrum Berlin für Materialien und Energie GmbH
+<https://www.helmholtz-berlin.de>
+
+This file is part of the alarm EPICS support module.
+
+alarm is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+alarm is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with alarm.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Scan source: named I/O Intr scan lists driven by periodic alarms,
+ * plus longin device support "alm Scan" to attach records to them.
+ *
+ * The link of a longin record with DTYP "alm Scan" is an INST_IO link
+ * naming the list, e.g. INP "@fast". The period can be set with the
+ * iocsh command almScanPeriod or with the info tag almScanPeriod (in
+ * microseconds) of any record in the list:
+ *
+ *   record(longin, "$(P)fastTick") {
+ *       field(DTYP, "alm Scan")
+ *       field(SCAN, "I/O Intr")
+ *       field(INP, "@fast")
+ *       field(FLNK, "$(P)fastCalc")
+ *       info(almScanPeriod, "250")
+ *   }
+ *
+ * The record's VAL is the number of periods since the list was started.
+ *
+ * A record of the list with a periodic SCAN (e.g. ".1 second") instead
+ * is processed by the standard periodic scan task. The first such record
+ * of a list serves as a reference: its processing intervals are measured
+ * as well, see almScanReport and almScanTest.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <epicsMutex.h>
+#include <epicsThread.h>
+#include <epicsInterrupt.h>
+#include <errlog.h>
+#include <dbAccess.h>
+#include <dbStaticLib.h>
+#include <dbScan.h>
+#include <devSup.h>
+#include <recGbl.h>
+#include <link.h>
+#include <longinRecord.h>
+#include <epicsVersion.h>
+#include <epicsExport.h>
+
+#include "almLib.h"
+#include "almScan.h"
+
+#if EPICS_VERSION==3 && EPICS_REVISION<=14
+/* no scanPeriod yet, but the periodic scan menu is fixed */
+static double scanPeriod(int scan)
+{
+    static const double periods[] = {10.0, 5.0, 2.0, 1.0, 0.5, 0.2, 0.1};
+
+    scan -= SCAN_1ST_PERIODIC;
+    return scan >= 0 && scan < 7 ? periods[scan] : 0.0;
+}
+#endif
+
+/* period statistics, updated from interrupt context */
+struct alm_scan_stats {
+    unsigned long   count;              /* periods */
+    alm_stamp_t     last;               /* time of last period */
+    long            min_dev;            /* interval - period */
+    long            max_dev;
+    alm_stamp_t     sum_dev;            /* sum of |interval - period| */
+};
+
+struct alm_scan_def {
+    struct alm_scan_def     *next;
+    char                    *name;
+    IOSCANPVT               ioscan;
+    alm_t                   alm;
+    alm_delay_t             period;
+    struct alm_scan_stats   stats;
+    dbCommon                *ref_rec;   /* periodically scanned record */
+    alm_delay_t             ref_period;
+    struct alm_scan_stats   ref;        /* updated by its scan task */
+};
+
+static struct alm_scan_def *alm_scan_lists;
+static epicsMutexId alm_scan_lock;
+static epicsThreadOnceId alm_scan_once = EPICS_THREAD_ONCE_INIT;
+
+static void alm_scan_init(void *arg)
+{
+    alm_scan_lock = epicsMutexMustCreate();
+}
+
+static void alm_scan_stats_reset(struct alm_scan_stats *st)
+{
+    int key = epicsInterruptLock();
+
+    st->count = 0;
+    st->last = 0;
+    st->min_dev = 0;
+    st->max_dev = 0;
+    st->sum_dev = 0;
+    epicsInterruptUnlock(key);
+}
+
+static void alm_scan_stats_add(struct alm_scan_stats *st,
+    alm_delay_t period)
+{
+    alm_stamp_t now = alm_get_stamp();
+    long dev;
+
+    if (st->last) {
+        dev = (long)(now - st->last) - (long)period;
+        if (st->count == 1 || dev < st->min_dev)
+            st->min_dev = dev;
+        if (st->count == 1 || dev > st->max_dev)
+            st->max_dev = dev;
+        st->sum_dev += dev < 0 ? -dev : dev;
+    }
+    st->last = now;
+    st->count++;
+}
+
+static void alm_scan_stats_print(const char *name, alm_delay_t period,
+    struct alm_scan_stats *st)
+{
+    unsigned long intervals = st->count > 1 ? st->count - 1 : 0;
+
+    printf("%s: period=%luus, periods=%lu", name, (unsigned long)period,
+        st->count);
+    if (intervals) {
+        printf(", jitter min=%ldus, max=%ldus, avg=%luus",
+            st->min_dev, st->max_dev,
+            (unsigned long)(st->sum_dev / intervals));
+    }
+    printf("\n");
+}
+
+/* alarm callback, runs in interrupt context */
+static void alm_scan_fire(void *arg)
+{
+    alm_scan_t scan = (alm_scan_t)arg;
+
+    alm_scan_stats_add(&scan->stats, scan->period);
+    scanIoRequest(scan->ioscan);
+}
+
+alm_scan_t almScanFind(const char *name)
+{
+    alm_scan_t scan;
+
+    epicsThreadOnce(&alm_scan_once, alm_scan_init, 0);
+    epicsMutexMustLock(alm_scan_lock);
+    for (scan = alm_scan_lists; scan; scan = scan->next) {
+        if (strcmp(scan->name, name) == 0) {
+            goto done;
+        }
+    }
+    scan = (alm_scan_t) calloc(1, sizeof(struct alm_scan_def));
+    if (!scan) {
+        goto done;
+    }
+    scan->name = malloc(strlen(name) + 1);
+    scan->alm = alm_create(alm_scan_fire, scan);
+    if (!scan->name || !scan->alm) {
+        if (scan->alm) alm_destroy(scan->alm);
+        free(scan->name);
+        free(scan);
+        scan = 0;
+        goto done;
+    }
+    strcpy(scan->name, name);
+    scanIoInit(&scan->ioscan);
+    scan->next = alm_scan_lists;
+    alm_scan_lists = scan;
+done:
+    epicsMutexUnlock(alm_scan_lock);
+    return scan;
+}
+
+IOSCANPVT almScanIoscan(alm_scan_t scan)
+{
+    return scan->ioscan;
+}
+
+unsigned long almScanCount(alm_scan_t scan)
+{
+    return scan->stats.count;
+}
+
+int almScanPeriod(const char *name, alm_delay_t period)
+{
+    alm_scan_t scan;
+
+    if (!name) {
+        printf("usage: almScanPeriod name period\n");
+        return -1;
+    }
+    if (alm_init_state() != ALM_INIT_OK) {
+        errlogSevPrintf(errlogMajor,
+            "almScanPeriod: alm_init has not been called\n");
+        return -1;
+    }
+    scan = almScanFind(name);
+    if (!scan) {
+        errlogSevPrintf(errlogMajor,
+            "almScanPeriod: cannot create scan list %s\n", name);
+        return -1;
+    }
+    alm_cancel_sync(scan->alm);
+    alm_scan_stats_reset(&scan->stats);
+    scan->period = period;
+    if (period) {
+        alm_start_periodic(scan->alm, period, period);
+    }
+    return 0;
+}
+
+void almScanReport(const char *name)
+{
+    alm_scan_t scan;
+
+    epicsThreadOnce(&alm_scan_once, alm_scan_init, 0);
+    epicsMutexMustLock(alm_scan_lock);
+    for (scan = alm_scan_lists; scan; scan = scan->next) {
+        if (!name || strcmp(scan->name, name) == 0) {
+            alm_scan_stats_print(scan->name, scan->period, &scan->stats);
+            if (scan->ref_rec) {
+                alm_scan_stats_print(scan->ref_rec->name, scan->ref_period,
+                    &scan->ref);
+            }
+        }
+    }
+    epicsMutexUnlock(alm_scan_lock);
+}
+
+#define ALM_SCAN_TEST "almScanTest"     /* scan list used by almScanTest */
+
+/* both done, or the reference record is no longer scanned */
+static int alm_scan_test_done(alm_scan_t scan, unsigned count,
+    alm_stamp_t start)
+{
+    int key = epicsInterruptLock();
+    int done = scan->stats.count > count
+        && (!scan->ref_rec || scan->ref.count > count
+            || alm_get_stamp() - start
+                > 2 * (alm_stamp_t)count * scan->ref_period + 1000000);
+
+    epicsInterruptUnlock(key);
+    return done;
+}
+
+void almScanTest(alm_delay_t period, unsigned count)
+{
+    alm_scan_t scan;
+    alm_stamp_t start;
+
+    if (!period || !count) {
+        printf("usage: almScanTest period count\n");
+        return;
+    }
+    if (almScanPeriod(ALM_SCAN_TEST, period) != 0) {
+        return;
+    }
+    scan = almScanFind(ALM_SCAN_TEST);
+    alm_scan_stats_reset(&scan->ref);
+    start = alm_get_stamp();
+    while (!alm_scan_test_done(scan, count, start)) {
+        epicsThreadSleep(period * 1e-6);
+    }
+    alm_cancel_sync(scan->alm);
+    alm_scan_stats_print("alm", period, &scan->stats);
+    if (scan->ref_rec) {
+        alm_scan_stats_print(scan->ref_rec->name, scan->ref_period,
+            &scan->ref);
+    } else {
+        printf("no periodically scanned record with INP \"@%s\"\n",
+            ALM_SCAN_TEST);
+    }
+}
+
+/*
+ * Device support: longin "alm Scan"
+ */
+
+static long alm_scan_init_record(longinRecord *prec)
+{
+    alm_scan_t scan;
+    DBENTRY entry;
+    const char *period = 0;
+
+    if (prec->inp.type != INST_IO) {
+        recGblRecordError(S_db_badField, prec,
+            "devLiAlmScan: INP must be INST_IO");
+        return S_db_badField;
+    }
+    scan = almScanFind(prec->inp.value.instio.string);
+    if (!scan) {
+        recGblRecordError(S_db_noMemory, prec,
+            "devLiAlmScan: cannot create scan list");
+        return S_db_noMemory;
+    }
+    prec->dpvt = scan;
+    if (prec->scan >= SCAN_1ST_PERIODIC && !scan->ref_rec) {
+        scan->ref_rec = (dbCommon *)prec;
+    }
+    dbInitEntry(pdbbase, &entry);
+    if (dbFindRecord(&entry, prec->name) == 0
+            && dbFindInfo(&entry, "almScanPeriod") == 0) {
+        period = dbGetInfoString(&entry);
+    }
+    if (period && almScanPeriod(scan->name, strtoul(period, 0, 0)) != 0) {
+        recGblRecordError(S_db_badField, prec,
+            "devLiAlmScan: cannot set period");
+    }
+    dbFinishEntry(&entry);
+    return 0;
+}
+
+static long alm_scan_get_ioint_info(int cmd, dbCommon *prec,
+    IOSCANPVT *ppvt)
+{
+    alm_scan_t scan = (alm_scan_t)prec->dpvt;
+
+    if (!scan) {
+        return -1;
+    }
+    *ppvt = scan->ioscan;
+    return 0;
+}
+
+static long alm_scan_read(longinRecord *prec)
+{
+    alm_scan_t scan = (alm_scan_t)prec->dpvt;
+    int key;
+
+    if (!scan) {
+        return -1;
+    }
+    if ((dbCommon *)prec == scan->ref_rec
+            && prec->scan >= SCAN_1ST_PERIODIC) {
+        key = epicsInterruptLock();     /* see alm_scan_stats_reset */
+        scan->ref_period = (alm_delay_t)(scanPeriod(prec->scan) * 1e6 + 0.5);
+        alm_scan_stats_add(&scan->ref, scan->ref_period);
+        epicsInterruptUnlock(key);
+    }
+    prec->val = (epicsInt32)scan->stats.count;
+    prec->udf = 0;
+    return 0;
+}
+
+struct {
+    long        number;
+    DEVSUPFUN   report;
+    DEVSUPFUN   init;
+    DEVSUPFUN   init_record;
+    DEVSUPFUN   get_ioint_info;
+    DEVSUPFUN   read_longin;
+} devLiAlmScan = {
+    5,
+    NULL,
+    NULL,
+    alm_scan_init_record,
+    alm_scan_get_ioint_info,
+    alm_scan_read
+};
+epicsExportAddress(dset, devLiAlmScan);
@@ -0,0 +1,81 @@
+/*==========================================================
+                             alarm
+  ==========================================================
+
+Copyright 2022 Helmholtz-Zentrum Berlin für Materialien und Energie GmbH
+<https://www.helmholtz-berlin.de>
+
+This file is part of the alarm EPICS support module.
+
+alarm is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+alarm is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with alarm.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef ALMSCAN_H
+#define ALMSCAN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <dbScan.h>
+#include "almLib.h"
+
+/*
+ * Named scan lists driven by periodic alarms (see alm_start_periodic).
+ * Records with SCAN "I/O Intr" and a device support that returns the
+ * list's IOSCANPVT (e.g. longin with DTYP "alm Scan") are processed
+ * every period with scanIoRequest.
+ */
+
+/*
+ * Find the scan list <name>, creating it if it does not exist yet.
+ * Returns NULL if allocation fails.
+ */
+typedef struct alm_scan_def *alm_scan_t;
+
+extern alm_scan_t almScanFind(const char *name);
+
+/* Return the scan list's IOSCANPVT */
+extern IOSCANPVT almScanIoscan(alm_scan_t scan);
+
+/* Return the number of periods since the list was (re)started */
+extern unsigned long almScanCount(alm_scan_t scan);
+
+/*
+ * Set the period of scan list <name> (in microseconds) and (re)start it;
+ * period 0 stops the list. The list is created if necessary. Returns 0
+ * on success, -1 on error.
+ */
+extern int almScanPeriod(const char *name, alm_delay_t period);
+
+/*
+ * Print period and jitter of scan list <name>, or of all lists if NULL,
+ * and of its periodically scanned reference record, if any.
+ */
+extern void almScanReport(const char *name);
+
+/*
+ * Measure the period jitter of the alarm driven scan list "almScanTest"
+ * with <period> microseconds, for <count> periods, and stop it again.
+ * If a longin record with DTYP "alm Scan" and INP "@almScanTest" has a
+ * periodic SCAN (e.g. ".1 second"), the intervals at which its scan task
+ * processes it are measured at the same time, for comparison.
+ */
+extern void almScanTest(alm_delay_t period, unsigned count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ifndef ALMSCAN_H */
@@ -0,0 +1,342 @@
+/*==========================================================
+                             alarm
+  ==========================================================
+
+Copyright 2022 Helmholtz-Zentrum Berlin für Materialien und Energie GmbH
+<https://www.helmholtz-berlin.de>
+
+This file is part of the alarm EPICS support module.
+
+alarm is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+alarm is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with alarm.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Device support for delayed and pulsed outputs with alarm clock
+ * precision, as a replacement for callbackRequestDelayed (which has
+ * system clock tick granularity).
+ *
+ * DTYP "alm Delay" (bo, longout, ao, calcout): on processing, the value
+ * is written to the OUT link (like soft channel device support) after
+ * the delay given by the info tag almDelay in microseconds. The record
+ * stays active (PACT) meanwhile and completes when the value has been
+ * written, so FLNK and monitors follow the actual write.
+ *
+ *   record(longout, "$(P)shutterOpen") {
+ *       field(DTYP, "alm Delay")
+ *       field(OUT, "$(P)shutter PP")
+ *       info(almDelay, "250")
+ *   }
+ *
+ * DTYP "alm Pulse" (bo): writing 1 writes 1 to the OUT link at once and
+ * sets the record back to 0 (and writes 0) after the pulse width given
+ * by the info tag almHigh in microseconds. Writing 1 again during the
+ * pulse restarts it, writing 0 ends it. Do not set the HIGH field.
+ *
+ * Each record has one alarm, set up at initialization and reused for
+ * every processing. On expiration the alarm handler passes the record
+ * to the callback task of the record's priority (PRIO) with
+ * callbackRequestProcessCallback. The end of a pulse is processed by
+ * alm_bo_pulse_end instead, which drops it if the record has been
+ * written in the meantime.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <callback.h>
+#include <epicsInterrupt.h>
+#include <dbAccess.h>
+#include <dbStaticLib.h>
+#include <dbDefs.h>
+#include <devSup.h>
+#include <recGbl.h>
+#include <recSup.h>
+#include <boRecord.h>
+#include <longoutRecord.h>
+#include <aoRecord.h>
+#include <calcoutRecord.h>
+#include <epicsExport.h>
+
+#include "almLib.h"
+
+struct alm_dev {
+    alm_storage_t   storage;            /* for the alarm */
+    alm_t           alm;
+    CALLBACK        cb;
+    dbCommon        *prec;
+    alm_delay_t     delay;              /* almDelay or almHigh */
+    int             pulse_end;          /* processing ends the pulse */
+    unsigned        pulse_gen;          /* writes, see alm_bo_pulse_end */
+    unsigned        fired_gen;          /* pulse_gen when the alarm fired */
+};
+
+/* read a numeric info tag of a record, return 0 if not found */
+static long alm_dev_info(dbCommon *prec, const char *name,
+    alm_delay_t *value)
+{
+    DBENTRY entry;
+    const char *str;
+    char *end;
+    long status = -1;
+
+    dbInitEntry(pdbbase, &entry);
+    if (dbFindRecord(&entry, prec->name) == 0
+            && dbFindInfo(&entry, name) == 0) {
+        str = dbGetInfoString(&entry);
+        *value = strtoul(str, &end, 0);
+        status = end == str ? -1 : 0;
+    }
+    dbFinishEntry(&entry);
+    return status;
+}
+
+/* alarm callback, runs in interrupt context */
+static void alm_dev_fire(void *arg)
+{
+    struct alm_dev *dev = (struct alm_dev *)arg;
+
+    callbackRequestProcessCallback(&dev->cb, dev->prec->prio, dev->prec);
+}
+
+static long alm_dev_init(dbCommon *prec, const char *tag,
+    alm_callback *callback)
+{
+    struct alm_dev *dev;
+
+    if (alm_init_state() != ALM_INIT_OK) {
+        recGblRecordError(S_dev_noDevSup, prec,
+            "devAlm: alm_init has not been called");
+        return S_dev_noDevSup;
+    }
+    dev = (struct alm_dev *) calloc(1, sizeof(struct alm_dev));
+    if (!dev) {
+        recGblRecordError(S_db_noMemory, prec, "devAlm");
+        return S_db_noMemory;
+    }
+    if (alm_dev_info(prec, tag, &dev->delay) != 0) {
+        recGblRecordError(S_db_badField, prec,
+            "devAlm: info tag missing or invalid");
+        free(dev);
+        return S_db_badField;
+    }
+    dev->prec = prec;
+    dev->alm = alm_init_static(&dev->storage, callback, dev);
+    prec->dpvt = dev;
+    return 0;
+}
+
+/*
+ * Common part of "alm Delay" write routines: returns 1 if the value is
+ * to be written now, 0 if the write has been deferred.
+ */
+static int alm_dev_delay(dbCommon *prec)
+{
+    struct alm_dev *dev = (struct alm_dev *)prec->dpvt;
+
+    if (prec->pact || !dev->delay) {
+        return 1;                       /* delay expired or none */
+    }
+    prec->pact = TRUE;
+    alm_start(dev->alm, dev->delay);
+    return 0;
+}
+
+/* pulse end: remember which pulse, then end it in the callback task */
+static void alm_bo_pulse_fire(void *arg)
+{
+    struct alm_dev *dev = (struct alm_dev *)arg;
+
+    dev->fired_gen = dev->pulse_gen;
+    callbackSetPriority(dev->prec->prio, &dev->cb);
+    callbackRequest(&dev->cb);
+}
+
+/*
+ * Process the record to end the pulse, unless it has been written since
+ * the alarm fired: then the pulse has been restarted or ended already.
+ * Each write cancels the alarm synchronously and then counts pulse_gen,
+ * so fired_gen and pulse_gen only match if no write came in between.
+ */
+static void alm_bo_pulse_end(CALLBACK *pcb)
+{
+    struct alm_dev *dev;
+    dbCommon *prec;
+    int key, current;
+
+    callbackGetUser(dev, pcb);
+    prec = dev->prec;
+    dbScanLock(prec);
+    key = epicsInterruptLock();         /* the next pulse may fire */
+    current = dev->fired_gen == dev->pulse_gen;
+    epicsInterruptUnlock(key);
+    if (current) {
+        dev->pulse_end = 1;
+        dbProcess(prec);
+        dev->pulse_end = 0;
+    }
+    dbScanUnlock(prec);
+}
+
+/* bo */
+
+static long alm_bo_init_record(boRecord *prec)
+{
+    long status = alm_dev_init((dbCommon *)prec, "almDelay", alm_dev_fire);
+
+    return status ? status : 2;         /* don't convert */
+}
+
+static long alm_bo_write(boRecord *prec)
+{
+    if (!prec->dpvt) {
+        return -1;
+    }
+    if (alm_dev_delay((dbCommon *)prec)) {
+        dbPutLink(&prec->out, DBR_USHORT, &prec->val, 1);
+    }
+    return 0;
+}
+
+static long alm_bo_pulse_init_record(boRecord *prec)
+{
+    long status = alm_dev_init((dbCommon *)prec, "almHigh",
+        alm_bo_pulse_fire);
+    struct alm_dev *dev = (struct alm_dev *)prec->dpvt;
+
+    if (status) {
+        return status;
+    }
+    callbackSetCallback(alm_bo_pulse_end, &dev->cb);
+    callbackSetUser(dev, &dev->cb);
+    return 2;                           /* don't convert */
+}
+
+static long alm_bo_pulse_write(boRecord *prec)
+{
+    struct alm_dev *dev = (struct alm_dev *)prec->dpvt;
+
+    if (!dev) {
+        return -1;
+    }
+    if (dev->pulse_end) {
+        prec->val = 0;
+    }
+    alm_cancel_sync(dev->alm);          /* a pending end is outdated */
+    dev->pulse_gen++;
+    if (prec->val && dev->delay) {
+        alm_start(dev->alm, dev->delay);
+    }
+    dbPutLink(&prec->out, DBR_USHORT, &prec->val, 1);
+    return 0;
+}
+
+/* longout */
+
+static long alm_lo_init_record(longoutRecord *prec)
+{
+    return alm_dev_init((dbCommon *)prec, "almDelay", alm_dev_fire);
+}
+
+static long alm_lo_write(longoutRecord *prec)
+{
+    if (!prec->dpvt) {
+        return -1;
+    }
+    if (alm_dev_delay((dbCommon *)prec)) {
+        dbPutLink(&prec->out, DBR_LONG, &prec->val, 1);
+    }
+    return 0;
+}
+
+/* ao */
+
+static long alm_ao_init_record(aoRecord *prec)
+{
+    long status = alm_dev_init((dbCommon *)prec, "almDelay", alm_dev_fire);
+
+    return status ? status : 2;         /* don't convert */
+}
+
+static long alm_ao_write(aoRecord *prec)
+{
+    if (!prec->dpvt) {
+        return -1;
+    }
+    if (alm_dev_delay((dbCommon *)prec)) {
+        dbPutLink(&prec->out, DBR_DOUBLE, &prec->oval, 1);
+    }
+    return 0;
+}
+
+/* calcout */
+
+static long alm_co_init_record(calcoutRecord *prec)
+{
+    return alm_dev_init((dbCommon *)prec, "almDelay", alm_dev_fire);
+}
+
+static long alm_co_write(calcoutRecord *prec)
+{
+    if (!prec->dpvt) {
+        return -1;
+    }
+    if (alm_dev_delay((dbCommon *)prec)) {
+        dbPutLink(&prec->out, DBR_DOUBLE, &prec->oval, 1);
+    }
+    return 0;
+}
+
+typedef struct {
+    long        number;
+    DEVSUPFUN   report;
+    DEVSUPFUN   init;
+    DEVSUPFUN   init_record;
+    DEVSUPFUN   get_ioint_info;
+    DEVSUPFUN   write;
+} alm_dset;
+
+typedef struct {
+    long        number;
+    DEVSUPFUN   report;
+    DEVSUPFUN   init;
+    DEVSUPFUN   init_record;
+    DEVSUPFUN   get_ioint_info;
+    DEVSUPFUN   write;
+    DEVSUPFUN   special_linconv;
+} alm_dset_ao;
+
+alm_dset devBoAlmDelay = {
+    5, NULL, NULL, alm_bo_init_record, NULL, alm_bo_write
+};
+epicsExportAddress(dset, devBoAlmDelay);
+
+alm_dset devBoAlmPulse = {
+    5, NULL, NULL, alm_bo_pulse_init_record, NULL, alm_bo_pulse_write
+};
+epicsExportAddress(dset, devBoAlmPulse);
+
+alm_dset devLoAlmDelay = {
+    5, NULL, NULL, alm_lo_init_record, NULL, alm_lo_write
+};
+epicsExportAddress(dset, devLoAlmDelay);
+
+alm_dset_ao devAoAlmDelay = {
+    6, NULL, NULL, alm_ao_init_record, NULL, alm_ao_write, NULL
+};
+epicsExportAddress(dset, devAoAlmDelay);
+
+alm_dset devCoAlmDelay = {
+    5, NULL, NULL, alm_co_init_record, NULL, alm_co_write
+};
+epicsExportAddress(dset, devCoAlmDelay);
@@ -53,6 +53,27 @@ unsigned long timer_get_max_delay(void);
 unsigned long timer_get_stamp(void);
 double timer_get_stamp_double(void);
 
+/*
+ * Tick interface, only needed for backends built with ALM_TICK_NATIVE
+ * (see Makefile). Ticks are the native resolution of the backend's
+ * counter; the number of ticks per microsecond must be integral.
+ */
+/* get the full 64 bit counter in ticks */
+unsigned long long timer_get_ticks(void);
+/* setup counter to go off in <delay> ticks */
+void timer_setup_ticks(unsigned long delay);
+/* return maximum accepted delay for routine 'timer_setup_ticks' */
+unsigned long timer_get_max_ticks(void);
+/* return the number of ticks per microsecond */
+unsigned long timer_get_ticks_per_usec(void);
+
+#ifdef __linux__
+/* switch to/from busy-poll mode on a dedicated core (see timer_Linux.c) */
+void timer_poll_mode(int enable, int cpu, int priority);
+/* print lateness and duty cycle of the poll thread */
+void timer_poll_report(int reset);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
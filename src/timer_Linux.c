@@ -21,61 +21,155 @@ You should have received a copy of the GNU General Public License
 along with alarm.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#define _GNU_SOURCE                     /* pthread_setaffinity_np */
 #include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <signal.h>
+#include <string.h>
+#include <errno.h>
 #include <time.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
 
 #include "epicsInterrupt.h"
+#include "epicsThread.h"
 #include "timer.h"
 
-#define CLOCKID CLOCK_REALTIME
+/*
+ * Use the monotonic clock, so that setting the system time does not
+ * move the deadlines of queued alarms. Wall clock alarms are handled
+ * in almLib.c (see alm_start_at_epics).
+ */
+#define CLOCKID CLOCK_MONOTONIC
 
-static timer_t timerid;
+static int timer_fd = -1;
 static VOID_FUNC_PTR int_handler;
 
+/*
+ * Busy-poll mode (see timer_poll_mode): instead of programming the POSIX
+ * timer, timer_setup_ticks only stores the absolute deadline, and a
+ * thread pinned to a dedicated core spins on the clock until it is
+ * reached. Deadline and mode are changed only under the interrupt lock
+ * (like the timer itself, see alm_setup_alarm); the poll thread reads
+ * the deadline without it.
+ */
+static int poll_enabled;
+static volatile int poll_stop;
+static pthread_t poll_thread;
+static unsigned long long poll_deadline;        /* 0: not armed */
+struct poll_stats {
+    unsigned long long  since;          /* start of measurement */
+    unsigned long long  busy;           /* time spent in the handler */
+    unsigned long long  fired;
+    unsigned long long  late_sum;       /* lateness, all in ns */
+    unsigned long long  late_min;
+    unsigned long long  late_max;
+    unsigned long long  late_1us;       /* fired more than 1us late */
+};
+static struct poll_stats poll_stats;
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __asm__ __volatile__("pause")
+#elif defined(__aarch64__)
+#define cpu_relax() __asm__ __volatile__("yield")
+#else
+#define cpu_relax()
+#endif
+
 #define errExit(msg) do { \
     perror(msg); return; \
 } while (0)
 
-static void handler(union sigval sig)
+/*
+ * The handler runs in a single dispatcher thread that waits for the
+ * timer on a timerfd. (With SIGEV_THREAD notification, libc would create
+ * a new thread for each expiration instead, whose stack has to be
+ * populated whenever it is not taken from the cache, see alm_init_ex.)
+ *
+ * Limitation: like an ISR on the other targets, the handler (with all
+ * callbacks) runs with the interrupt lock held, which on Linux is one
+ * process-wide mutex. So each activation serializes with every
+ * epicsInterruptLock in the IOC, not only with those in almLib.c.
+ */
+static void dispatcher(void *arg)
 {
-    int lock_stat = epicsInterruptLock();
-    int_handler();
-    epicsInterruptUnlock(lock_stat);
+    volatile char stack[32*1024];
+    uint64_t expirations;
+    int lock_stat;
+    size_t n;
+
+    /* prefault the stack, the handler must not page fault */
+    for (n = 0; n < sizeof(stack); n += 256)
+        stack[n] = 0;
+    for (;;) {
+        if (read(timer_fd, &expirations, sizeof(expirations)) < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            perror("timer read");
+            return;
+        }
+        lock_stat = epicsInterruptLock();
+        int_handler();
+        epicsInterruptUnlock(lock_stat);
+    }
 }
 
 void timer_init(void)
 {
 }
 
-/* setup counter to go off in <delay> microseconds */
-void timer_setup (unsigned long delay)
+static void timer_arm (time_t sec, long nsec)
 {
     struct itimerspec its;
 
-    its.it_value.tv_sec = delay / 1000000;
-    its.it_value.tv_nsec = delay % 1000000;
+    its.it_value.tv_sec = sec;
+    its.it_value.tv_nsec = nsec;
     its.it_interval.tv_sec = 0;
     its.it_interval.tv_nsec = 0;
 
-    if (timer_settime(timerid, 0, &its, NULL) < 0)
-        errExit("timer_settime");
+    if (timerfd_settime(timer_fd, 0, &its, NULL) < 0)
+        errExit("timerfd_settime");
+}
+
+/* setup counter to go off in <delay> microseconds */
+void timer_setup (unsigned long delay)
+{
+    if (poll_enabled) {
+        __atomic_store_n(&poll_deadline,
+            timer_get_ticks() + (unsigned long long)delay * 1000,
+            __ATOMIC_RELEASE);
+        return;
+    }
+    timer_arm(delay / 1000000, (delay % 1000000) * 1000);
+}
+
+/* setup counter to go off in <delay> nanoseconds */
+void timer_setup_ticks (unsigned long delay)
+{
+    if (poll_enabled) {
+        __atomic_store_n(&poll_deadline, timer_get_ticks() + delay,
+            __ATOMIC_RELEASE);
+        return;
+    }
+    timer_arm(delay / 1000000000, delay % 1000000000);
 }
 
 /* enable interrupts */
 void timer_enable (void)
 {
-    struct sigevent sev;
-
-    sev.sigev_notify = SIGEV_THREAD;
-    sev.sigev_notify_function = handler;
-    sev.sigev_notify_attributes = 0;
-    sev.sigev_value.sival_ptr = &timerid;
-    if (timer_create(CLOCKID, &sev, &timerid) < 0)
-        errExit("timer_create");
+    if (timer_fd >= 0)
+        return;
+    timer_fd = timerfd_create(CLOCKID, TFD_CLOEXEC);
+    if (timer_fd < 0)
+        errExit("timerfd_create");
+    if (!epicsThreadCreate("almTimer", epicsThreadPriorityMax,
+            epicsThreadGetStackSize(epicsThreadStackMedium),
+            dispatcher, 0)) {
+        fprintf(stderr, "timer_enable: cannot create dispatcher thread\n");
+    }
 }
 
 /* disable interrupts */
@@ -83,13 +177,17 @@ void timer_disable (void)
 {
     struct itimerspec its;
 
+    __atomic_store_n(&poll_deadline, 0, __ATOMIC_RELEASE);
+    if (timer_fd < 0)
+        return;
+
     its.it_value.tv_sec = 0;
     its.it_value.tv_nsec = 0;
     its.it_interval.tv_sec = 0;
     its.it_interval.tv_nsec = 0;
 
-    if (timer_settime(timerid, 0, &its, NULL) < 0)
-        errExit("timer_settime");
+    if (timerfd_settime(timer_fd, 0, &its, NULL) < 0)
+        errExit("timerfd_settime");
 }
 
 /* initialize (reset) counter and enable or disable interrupts */
@@ -129,6 +227,26 @@ unsigned long timer_get_max_delay (void)
     return ULONG_MAX;
 }
 
+/* return maximum accepted delay for routine 'timer_setup_ticks' */
+unsigned long timer_get_max_ticks (void)
+{
+    return ULONG_MAX;
+}
+
+/* ticks are nanoseconds */
+unsigned long timer_get_ticks_per_usec (void)
+{
+    return 1000;
+}
+
+/* get the clock in nanoseconds */
+unsigned long long timer_get_ticks (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCKID, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
 /* get a timestamp in microseconds, as integral or floating point value */
 unsigned long timer_get_stamp (void)
 {
@@ -145,3 +263,169 @@ double timer_get_stamp_double (void)
     clock_gettime(CLOCKID, &ts);
     return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
 }
+
+/*
+ * Busy-poll mode
+ */
+
+static void *poll_run (void *arg)
+{
+    unsigned long long due, now, done, late;
+    volatile char stack[32*1024];
+    int lock_stat;
+    size_t n;
+
+    /* prefault the stack, the handler must not page fault */
+    for (n = 0; n < sizeof(stack); n += 256)
+        stack[n] = 0;
+    while (!poll_stop) {
+        due = __atomic_load_n(&poll_deadline, __ATOMIC_ACQUIRE);
+        if (!due || (now = timer_get_ticks()) < due) {
+            cpu_relax();
+            continue;
+        }
+        lock_stat = epicsInterruptLock();
+        /* may have been re-armed or disabled meanwhile */
+        due = poll_deadline;
+        if (due && now >= due) {
+            __atomic_store_n(&poll_deadline, 0, __ATOMIC_RELAXED);
+            int_handler();
+            done = timer_get_ticks();
+            late = now - due;
+            poll_stats.busy += done - now;
+            poll_stats.fired++;
+            poll_stats.late_sum += late;
+            if (late < poll_stats.late_min)
+                poll_stats.late_min = late;
+            if (late > poll_stats.late_max)
+                poll_stats.late_max = late;
+            if (late > 1000)
+                poll_stats.late_1us++;
+        }
+        epicsInterruptUnlock(lock_stat);
+    }
+    return 0;
+}
+
+static void poll_reset_stats (void)
+{
+    memset(&poll_stats, 0, sizeof(poll_stats));
+    poll_stats.late_min = ~0ull;
+    poll_stats.since = timer_get_ticks();
+}
+
+static int poll_start (int cpu, int priority)
+{
+    pthread_attr_t attr;
+    struct sched_param param;
+    cpu_set_t cpus;
+    int status;
+
+    poll_stop = 0;
+    pthread_attr_init(&attr);
+    if (priority > 0) {
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        param.sched_priority = priority;
+        pthread_attr_setschedparam(&attr, &param);
+    }
+    status = pthread_create(&poll_thread, &attr, poll_run, 0);
+    if (status && priority > 0) {
+        fprintf(stderr, "timer_poll_mode: SCHED_FIFO priority %d: %s, "
+            "using default scheduling\n", priority, strerror(status));
+        pthread_attr_destroy(&attr);
+        pthread_attr_init(&attr);
+        status = pthread_create(&poll_thread, &attr, poll_run, 0);
+    }
+    pthread_attr_destroy(&attr);
+    if (status) {
+        fprintf(stderr, "timer_poll_mode: pthread_create: %s\n",
+            strerror(status));
+        return -1;
+    }
+    if (cpu >= 0) {
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        status = pthread_setaffinity_np(poll_thread, sizeof(cpus), &cpus);
+        if (status) {
+            fprintf(stderr, "timer_poll_mode: cpu %d: %s\n", cpu,
+                strerror(status));
+        }
+    }
+    pthread_setname_np(poll_thread, "almPoll");
+    return 0;
+}
+
+/*
+ * Switch between POSIX timer (enable=0) and busy-poll mode (enable=1)
+ * at runtime. In poll mode the dispatcher thread runs on core <cpu> (no
+ * pinning if negative) with SCHED_FIFO priority <priority> (default
+ * scheduling if zero). It uses up the whole core, which should thus be
+ * reserved with the isolcpus (and nohz_full) kernel parameters. A
+ * pending deadline is carried over in both directions.
+ */
+void timer_poll_mode (int enable, int cpu, int priority)
+{
+    struct itimerspec its;
+    unsigned long long due;
+    int lock_stat;
+
+    if (poll_enabled) {
+        lock_stat = epicsInterruptLock();
+        due = poll_deadline;
+        poll_enabled = 0;
+        __atomic_store_n(&poll_deadline, 0, __ATOMIC_RELAXED);
+        if (due && timer_fd >= 0) {
+            unsigned long long now = timer_get_ticks();
+            unsigned long long delay = due > now ? due - now : 1;
+
+            timer_arm(delay / 1000000000, delay % 1000000000);
+        }
+        epicsInterruptUnlock(lock_stat);
+        poll_stop = 1;
+        pthread_join(poll_thread, 0);
+    }
+    if (!enable)
+        return;
+    if (poll_start(cpu, priority) < 0)
+        return;
+    lock_stat = epicsInterruptLock();
+    poll_reset_stats();
+    if (timer_fd >= 0 && timerfd_gettime(timer_fd, &its) == 0
+            && (its.it_value.tv_sec || its.it_value.tv_nsec)) {
+        due = timer_get_ticks()
+            + (unsigned long long)its.it_value.tv_sec * 1000000000ull
+            + its.it_value.tv_nsec;
+        timer_disable();
+        __atomic_store_n(&poll_deadline, due, __ATOMIC_RELEASE);
+    }
+    poll_enabled = 1;
+    epicsInterruptUnlock(lock_stat);
+}
+
+/* print lateness and duty cycle of the poll thread, optionally reset */
+void timer_poll_report (int reset)
+{
+    struct poll_stats stats;
+    unsigned long long elapsed;
+    int lock_stat;
+
+    if (!poll_enabled) {
+        printf("poll mode disabled\n");
+        return;
+    }
+    lock_stat = epicsInterruptLock();
+    elapsed = timer_get_ticks() - poll_stats.since;
+    stats = poll_stats;
+    if (reset)
+        poll_reset_stats();
+    epicsInterruptUnlock(lock_stat);
+    printf("fired=%llu, late min=%lluns, max=%lluns, avg=%lluns, "
+        "over 1us=%llu\n", stats.fired,
+        stats.fired ? stats.late_min : 0, stats.late_max,
+        stats.fired ? stats.late_sum / stats.fired : 0,
+        stats.late_1us);
+    printf("duty cycle=%.3f%% (handler %lluus of %lluus)\n",
+        elapsed ? 100.0 * stats.busy / elapsed : 0.0,
+        stats.busy / 1000, elapsed / 1000);
+}
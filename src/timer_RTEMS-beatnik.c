@@ -33,6 +33,7 @@ along with alarm.  If not, see <https://www.gnu.org/licenses/>.
 #include <bsp/gt_timer.h>
 
 #include "timer.h"
+#include "timer_conv.h"
 
 #include "ppc_timebase_reg.c"
 
@@ -44,6 +45,10 @@ static uint32_t alarm_due=0;
 
 static void (*callback)(void*)=0;
 
+static timer_conv_t timebase_conv;  /* timebase ticks per usec */
+
+extern unsigned int BSP_bus_frequency; /* make variable visible */
+
 void timer_init(void)
   {
     uint32_t i_alarm_ticks_per_sec;
@@ -64,6 +69,9 @@ void timer_init(void)
     /* alarm_ticks_per_usec is usually 133.333333 */
     alarm_ticks_per_usec= (unsigned long)d_alarm_ticks_per_usec;
     alarm_max= (unsigned long)(0xffffffff/d_alarm_ticks_per_usec) - 1;
+
+    timer_conv_init(&timebase_conv,
+        ((uint64_t) BSP_bus_frequency / 4ULL) / USECS_PER_SEC);
   }
 
 void timer_setup(unsigned long delay)
@@ -112,17 +120,14 @@ unsigned long timer_get_max_delay(void)
     return alarm_max;
   }
 
-extern unsigned int BSP_bus_frequency; /* make variable visible */
-
 static unsigned long timer_timebase_to_usec(uint64_t t)
 {
     uint64_t delay;
 
-    /* during the calculation we need a int64 because the 
-     * result is (maybe) larger then the input value 
-     * (it takes effect if the bus frequency is above 4Mhz)
+    /* the divisor is only known at run time; use the precomputed
+     * reciprocal instead of a (slow) 64 bit division
      */
-    delay = t / (((uint64_t) BSP_bus_frequency / 4ULL) / USECS_PER_SEC);
+    delay = timer_conv_div(&timebase_conv, t);
 
     return (unsigned long) (delay & 0xFFFFFFFF);
 } 
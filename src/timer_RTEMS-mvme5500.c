@@ -31,6 +31,7 @@ along with alarm.  If not, see <https://www.gnu.org/licenses/>.
 #include <bsp/irq.h>            /* rtems_interrupt_catch()                      */
 
 #include "timer.h"
+#include "timer_conv.h"
 
 #include "ppc_timebase_reg.c"
 
@@ -88,6 +89,9 @@ extern unsigned int BSP_bus_frequency; /* make variable visible */
  * frequency: both were triggered with a quarter of the bus cycle
  */
 
+/* timebase ticks per microsecond, set up by timer_init */
+static timer_conv_t timebase_conv;
+
 static unsigned long timer_usec_to_timerticks(unsigned long delay)
 {
     epicsUInt64 ticks;
@@ -106,18 +110,17 @@ static unsigned long timer_timerticks_to_usec(unsigned long ticks)
 /* if the bus frequency is lower than 4Mhz a greater datatype 
  * would be necessary, MV500 has 66Mhz -> so we can ignore this case
  */
-    return (epicsUInt64) ticks / (((epicsUInt64) BSP_bus_frequency / 4ULL) / USECS_PER_SEC);
+    return timer_conv_div(&timebase_conv, ticks);
 }
 
 static unsigned long timer_timebase_to_usec(epicsUInt64 t)
 {
     epicsUInt64 delay;
 
-/* during the calculation we need a int64 because the 
- * result is (maybe) larger then the input value 
- * (it takes effect if the bus frequency is above 4Mhz)
+/* the divisor is only known at run time; use the precomputed
+ * reciprocal instead of a (slow) 64 bit division
  */
-    delay = t / (((epicsUInt64) BSP_bus_frequency / 4ULL) / USECS_PER_SEC);
+    delay = timer_conv_div(&timebase_conv, t);
     
     return (unsigned long) (delay & 0xFFFFFFFF);
 } 
@@ -130,6 +133,14 @@ static unsigned long timer_timebase_to_usec(epicsUInt64 t)
 
 void timer_init(void)
 {
+    static int done = 0;
+
+    if (done) {
+        return;
+    }
+    done = 1;
+    timer_conv_init(&timebase_conv,
+        ((epicsUInt64) BSP_bus_frequency / 4ULL) / USECS_PER_SEC);
 }
 
 unsigned long timer_get_stamp(void)
@@ -150,9 +161,34 @@ double timer_get_stamp_double(void)
 
 void timer_setup(unsigned long delay)
 {
-    unsigned long delay_in_timerticks;
-    delay_in_timerticks = timer_usec_to_timerticks(delay);
-        
+    timer_setup_ticks(timer_usec_to_timerticks(delay));
+}
+
+/*
+ * Tick interface: timer and timebase run at the same frequency,
+ * so timebase ticks can be used directly as timer ticks.
+ */
+
+unsigned long long timer_get_ticks(void)
+{
+    unsigned long tbu = 0, tbl = 0;
+
+    readTimeBaseReg(&tbu, &tbl);
+    return (epicsUInt64) tbu << 32 | (epicsUInt64) tbl;
+}
+
+unsigned long timer_get_max_ticks(void)
+{
+    return LONG_MAX;
+}
+
+unsigned long timer_get_ticks_per_usec(void)
+{
+    return ((epicsUInt64) BSP_bus_frequency / 4ULL) / USECS_PER_SEC;
+}
+
+void timer_setup_ticks(unsigned long delay_in_timerticks)
+{
     /* disable counter 3 */
     MV64260_WRITE32_PUSH (MV64260_REG_BASE, TMR_CNTR_CTRL_0_3, MV64260_READ32(MV64260_REG_BASE, TMR_CNTR_CTRL_0_3) & ~TMR_CNTR_CTRL_TC3EN_MASK);
 
@@ -0,0 +1,228 @@
+/*==========================================================
+                             alarm
+  ==========================================================
+
+Copyright 2022 Helmholtz-Zentrum Berlin für Materialien und Energie GmbH
+<https://www.helmholtz-berlin.de>
+
+This file is part of the alarm EPICS support module.
+
+alarm is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+alarm is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with alarm.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Conversion engine for timer backends.
+ *
+ * On 32 bit targets a 64 bit division by a non-constant divisor ends up
+ * in __udivdi3 (see div64.c), a bit-by-bit loop of up to 64 iterations.
+ * Instead, timer_conv_init computes m and s such that
+ *
+ *   x / d == (x * m) >> (64 + s)
+ *
+ * for all 64 bit x (see Granlund/Montgomery, "Division by Invariant
+ * Integers using Multiplication"). If m needs 65 bits, only the lower
+ * 64 bits are stored and the missing addition is done in
+ * timer_conv_div, without overflow.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "almLib.h"
+#include "timer_conv.h"
+
+#define HIGH_BIT 0x8000000000000000ull
+
+/* return the high 64 bits of the 128 bit product a * b */
+static unsigned long long mulhi(unsigned long long a, unsigned long long b)
+{
+    unsigned long long a_lo = a & 0xffffffffull, a_hi = a >> 32;
+    unsigned long long b_lo = b & 0xffffffffull, b_hi = b >> 32;
+    unsigned long long lo_lo = a_lo * b_lo;
+    unsigned long long hi_lo = a_hi * b_lo;
+    unsigned long long lo_hi = a_lo * b_hi;
+    unsigned long long cross;
+
+    cross = (lo_lo >> 32) + (hi_lo & 0xffffffffull) + lo_hi;
+    return a_hi * b_hi + (hi_lo >> 32) + (cross >> 32);
+}
+
+static unsigned floor_log2(unsigned long long x)
+{
+    unsigned n = 0;
+
+    while (x >>= 1)
+        n++;
+    return n;
+}
+
+void timer_conv_init(timer_conv_t *conv, unsigned long long divisor)
+{
+    unsigned long long quot = 0, rem, e;
+    unsigned log2d = floor_log2(divisor);
+    int n;
+
+    conv->divisor = divisor;
+    conv->shift = log2d;
+    conv->add = 0;
+    conv->mult = 0;
+    if ((divisor & (divisor - 1)) == 0) {
+        return;                         /* power of two: plain shift */
+    }
+    /* quot, rem = 2^(64+log2d) divmod divisor (long division, 2^log2d < d) */
+    rem = 1ull << log2d;
+    for (n = 0; n < 64; n++) {
+        int carry = (rem & HIGH_BIT) != 0;
+
+        rem <<= 1;
+        quot <<= 1;
+        if (carry || rem >= divisor) {
+            rem -= divisor;
+            quot |= 1;
+        }
+    }
+    e = divisor - rem;
+    if (e < (1ull << log2d)) {
+        /* m = quot + 1 fits into 64 bits */
+        conv->mult = quot + 1;
+    } else {
+        /* use 2^(65+log2d)/d, i.e. a 65 bit multiplier */
+        unsigned long long twice_rem = rem + rem;
+
+        quot += quot;
+        if (twice_rem >= divisor || twice_rem < rem)
+            quot += 1;
+        conv->mult = quot + 1;
+        conv->add = 1;
+    }
+}
+
+unsigned long long timer_conv_div(const timer_conv_t *conv, unsigned long long x)
+{
+    unsigned long long q;
+
+    if (!conv->mult) {
+        return x >> conv->shift;
+    }
+    q = mulhi(conv->mult, x);
+    if (conv->add) {
+        return (((x - q) >> 1) + q) >> conv->shift;
+    }
+    return q >> conv->shift;
+}
+
+/*
+ * Test code follows
+ */
+
+static unsigned long conv_errors;
+
+static void conv_check(const timer_conv_t *conv, unsigned long long x)
+{
+    unsigned long long expected = x / conv->divisor;
+    unsigned long long result = timer_conv_div(conv, x);
+
+    if (result != expected) {
+        if (conv_errors < 10) {
+            printf("ERROR: %llu / %llu: expected %llu, got %llu\n",
+                x, conv->divisor, expected, result);
+        }
+        conv_errors++;
+    }
+}
+
+static unsigned long long rand64(void)
+{
+    unsigned long long r = 0;
+    int n;
+
+    for (n = 0; n < 4; n++) {
+        r = (r << 16) ^ (unsigned)rand();
+    }
+    return r;
+}
+
+#define BENCH_NUM 1000000
+
+/*
+ * Check timer_conv_div against plain division for divisor <divisor>
+ * (or for a set of typical divisors if zero) and compare execution time.
+ *
+ * Checked are the boundaries around each multiple of the divisor near
+ * all powers of two, near the top of the 64 bit range, and a number of
+ * random values. If <exhaustive> is non-zero, all quotients below 2^32
+ * (the range visible through timer_get_stamp) are checked at both ends
+ * of their interval, which takes a while.
+ */
+void timer_conv_test(unsigned long divisor, int exhaustive)
+{
+    static const unsigned long typical[] = {
+        16, 25, 33, 41, 100, 133, 1000, 0
+    };
+    unsigned long single[2];
+    const unsigned long *d;
+    timer_conv_t conv;
+    unsigned long long x, sum;
+    alm_stamp_t t1, t2, t3;
+    volatile unsigned long long divisor_v;
+    int n, k;
+
+    single[0] = divisor;
+    single[1] = 0;
+    for (d = divisor ? single : typical; *d; d++) {
+        conv_errors = 0;
+        timer_conv_init(&conv, *d);
+        for (n = 0; n < 64; n++) {
+            unsigned long long p = 1ull << n;
+            unsigned long long q = p / *d;
+
+            for (k = -2; k <= 2; k++) {
+                conv_check(&conv, p + k);
+                conv_check(&conv, (q + k) * *d);
+                conv_check(&conv, (q + k) * *d - 1);
+            }
+        }
+        for (x = 0; x < 1000; x++) {
+            conv_check(&conv, x);
+            conv_check(&conv, ~0ull - x);
+        }
+        for (n = 0; n < BENCH_NUM; n++) {
+            conv_check(&conv, rand64());
+        }
+        if (exhaustive) {
+            for (x = 0; x < 0x100000000ull; x++) {
+                conv_check(&conv, x * *d);
+                conv_check(&conv, x * *d + *d - 1);
+            }
+        }
+        /* timing */
+        divisor_v = *d;
+        sum = 0;
+        t1 = alm_get_stamp();
+        for (x = 0; x < BENCH_NUM; x++) {
+            sum += timer_conv_div(&conv, x << 20);
+        }
+        t2 = alm_get_stamp();
+        for (x = 0; x < BENCH_NUM; x++) {
+            sum -= (x << 20) / divisor_v;
+        }
+        t3 = alm_get_stamp();
+        printf("divisor=%lu: mult=0x%llx, shift=%u, add=%d, errors=%lu\n",
+            *d, conv.mult, conv.shift, conv.add, conv_errors);
+        printf("divisor=%lu: reciprocal=%luns, division=%luns%s\n", *d,
+            (unsigned long)((t2 - t1) * 1000 / BENCH_NUM),
+            (unsigned long)((t3 - t2) * 1000 / BENCH_NUM),
+            sum ? " (checksum mismatch)" : "");
+    }
+}
@@ -0,0 +1,55 @@
+/*==========================================================
+                             alarm
+  ==========================================================
+
+Copyright 2022 Helmholtz-Zentrum Berlin für Materialien und Energie GmbH
+<https://www.helmholtz-berlin.de>
+
+This file is part of the alarm EPICS support module.
+
+alarm is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+alarm is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with alarm.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef TIMER_CONV_H
+#define TIMER_CONV_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Division of 64 bit values by a divisor that is known only at run time
+ * (e.g. ticks per microsecond derived from the bus frequency), done as a
+ * multiplication with a precomputed reciprocal. The result is exact for
+ * the whole 64 bit range, i.e. identical to x / divisor.
+ */
+typedef struct {
+    unsigned long long  divisor;
+    unsigned long long  mult;       /* reciprocal, 0 for powers of two */
+    unsigned            shift;
+    int                 add;        /* reciprocal needs 65 bits */
+} timer_conv_t;
+
+/* precompute reciprocal; <divisor> must not be zero */
+void timer_conv_init(timer_conv_t *conv, unsigned long long divisor);
+/* return x / conv->divisor */
+unsigned long long timer_conv_div(const timer_conv_t *conv, unsigned long long x);
+
+/* Test routine */
+void timer_conv_test(unsigned long divisor, int exhaustive);
+
+#ifdef __cplusplus
+}
+#endif
+#endif